@@ -0,0 +1,137 @@
+#pragma once
+
+/// Bit-packed writing and reading of sub-byte fields, such as booleans and
+/// small enums, layered on any SerialStorm stream.  Fields are packed least
+/// significant bit first into a 64-bit register, which is flushed to the
+/// stream as whole words as it fills.  Call align() to flush any partial
+/// bytes; after that the stream is byte aligned again, and ordinary pod,
+/// varint and other calls can be made on it.  The reader must align at the
+/// same points as the writer.  The bytes on the wire do not depend on host
+/// byte order.
+
+#include <cstdint>
+
+namespace serialstorm {
+
+template<typename StreamT>
+class bit_writer {
+  /// Accumulates bit fields and writes them to a stream.  Partial bytes are
+  /// not flushed on destruction, so always finish with align()
+  StreamT &stream;
+  uint64_t bits{0};                                                             // bits waiting to be written, least significant first
+  unsigned int count{0};                                                        // number of bits waiting to be written, always less than 64
+
+public:
+  explicit bit_writer(StreamT &this_stream)
+    : stream(this_stream) {
+    /// Specific constructor
+  }
+
+  bit_writer(bit_writer const&) = delete;
+  bit_writer &operator=(bit_writer const&) = delete;
+
+  inline void write_bits(uint64_t value, unsigned int const bit_count) {
+    /// Write the lowest bit_count bits of value, up to 64
+    if(bit_count < 64) {
+      value &= (uint64_t{1} << bit_count) - 1;
+    }
+    bits |= value << count;
+    if(count + bit_count < 64) {
+      count += bit_count;
+      return;
+    }
+    write_word();                                                               // the register is full, send it on and keep any overflow
+    unsigned int const written(64 - count);
+    bits = written == 64 ? 0 : value >> written;
+    count = count + bit_count - 64;
+  }
+
+  inline void write_bool(bool const value) {
+    /// Write a single bit
+    write_bits(value ? 1 : 0, 1);
+  }
+
+  inline void align() {
+    /// Flush any bits still waiting to be written, padded to a whole byte
+    if(count == 0) {
+      return;
+    }
+    uint8_t bytes[8];
+    unsigned int const byte_count((count + 7) / 8);
+    for(unsigned int i = 0; i != byte_count; ++i) {
+      bytes[i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    stream.write_pod_array(bytes, byte_count);
+    bits = 0;
+    count = 0;
+  }
+
+private:
+  inline void write_word() {
+    /// Write the full register to the stream, least significant byte first
+    uint8_t bytes[8];
+    for(unsigned int i = 0; i != 8; ++i) {
+      bytes[i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    stream.write_pod_array(bytes, 8);
+  }
+};
+
+template<typename StreamT>
+class bit_reader {
+  /// Reads bit fields written by a bit_writer from a stream.  Only whole bytes
+  /// that are needed are ever read from the stream, so reading never runs
+  /// past the writer's alignment point
+  StreamT const &stream;
+  uint64_t bits{0};                                                             // bits read from the stream but not yet returned, least significant first
+  unsigned int count{0};                                                        // number of bits read from the stream but not yet returned
+
+public:
+  explicit bit_reader(StreamT const &this_stream)
+    : stream(this_stream) {
+    /// Specific constructor
+  }
+
+  bit_reader(bit_reader const&) = delete;
+  bit_reader &operator=(bit_reader const&) = delete;
+
+  inline uint64_t read_bits(unsigned int const bit_count) {
+    /// Read a field of bit_count bits, up to 64
+    if(bit_count > 32) {                                                        // split wide fields so the register can never overflow while filling
+      uint64_t const low(read_bits(32));
+      return low | (read_bits(bit_count - 32) << 32);
+    }
+    if(bit_count > count) {
+      fill(bit_count - count);
+    }
+    uint64_t const value(bits & ((uint64_t{1} << bit_count) - 1));
+    bits >>= bit_count;
+    count -= bit_count;
+    return value;
+  }
+
+  inline bool read_bool() {
+    /// Read a single bit
+    return read_bits(1) != 0;
+  }
+
+  inline void align() {
+    /// Discard the padding bits remaining in the current byte
+    bits = 0;
+    count = 0;
+  }
+
+private:
+  inline void fill(unsigned int const bit_count) {
+    /// Read enough whole bytes from the stream to supply at least bit_count more bits
+    uint8_t bytes[8];
+    unsigned int const byte_count((bit_count + 7) / 8);
+    stream.read_pod_array(bytes, byte_count);
+    for(unsigned int i = 0; i != byte_count; ++i) {
+      bits |= static_cast<uint64_t>(bytes[i]) << (count + 8 * i);
+    }
+    count += 8 * byte_count;
+  }
+};
+
+}
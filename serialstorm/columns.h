@@ -0,0 +1,345 @@
+#pragma once
+
+/// Columnar batches: arrays of records sent as one column per field rather
+/// than one record after another, so values of the same type and similar
+/// magnitude sit together.  Pod columns move as a single bulk copy, integer
+/// columns are varint-packed into one contiguous block, optionally as deltas
+/// from the previous record, and everything else is sent value by value.
+/// Records are reassembled on reading.  The batch is sent as its record
+/// count followed by each column in turn, in the order they are described.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "stream_base.h"
+
+namespace serialstorm {
+
+enum class column_encoding : uint8_t {                                          // how a column's values are sent
+  POD,                                                                          // one bulk copy of every value, as pods
+  VARINT,                                                                       // varint-packed block, zigzag encoded for signed types
+  DELTA,                                                                        // as VARINT, but each value as the difference from the one before, for sorted or slowly changing values
+  VALUE                                                                         // each value in turn with write_value, for strings and containers
+};
+
+namespace detail {
+
+template<typename T> struct column_member_traits;
+template<typename Class, typename T> struct column_member_traits<T Class::*> {
+  using class_type = Class;
+  using value_type = T;
+};
+
+template<typename T>
+inline constexpr column_encoding default_column_encoding() {
+  /// Choose the encoding a column of this type is sent with unless told otherwise
+  if constexpr(std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+    return column_encoding::VARINT;
+  } else if constexpr(is_pod_value<T>) {
+    return column_encoding::POD;
+  } else {
+    return column_encoding::VALUE;
+  }
+}
+
+template<typename T>
+inline constexpr std::make_unsigned_t<T> zigzag_encode(T const value) {
+  /// Map a signed value to an unsigned one with small magnitudes kept small:
+  /// 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+  using unsigned_type = std::make_unsigned_t<T>;
+  if constexpr(std::is_signed_v<T>) {
+    return static_cast<unsigned_type>((static_cast<unsigned_type>(value) << 1) ^ static_cast<unsigned_type>(value < 0 ? ~unsigned_type{0} : unsigned_type{0}));
+  } else {
+    return value;
+  }
+}
+
+template<typename T>
+inline constexpr T zigzag_decode(std::make_unsigned_t<T> const value) {
+  /// Reverse zigzag_encode
+  using unsigned_type = std::make_unsigned_t<T>;
+  if constexpr(std::is_signed_v<T>) {
+    return static_cast<T>(static_cast<unsigned_type>(value >> 1) ^ static_cast<unsigned_type>(value & 1u ? ~unsigned_type{0} : unsigned_type{0}));
+  } else {
+    return value;
+  }
+}
+
+template<varint_codec Codec>
+inline uint8_t *encode_column_varint(uint64_t const value, uint8_t *bytes) {
+  /// Encode one varint of a column straight into memory, with room for
+  /// varint_size_max bytes, returning the end of what was written
+  if constexpr(Codec == varint_codec::LEB128) {
+    return bytes + encode_varint_leb128(value, bytes);
+  } else if constexpr(Codec == varint_codec::PREFIX) {
+    return bytes + encode_varint_prefix(value, bytes);
+  } else {
+    return bytes + encode_varint_tagged(value, bytes);
+  }
+}
+
+template<typename T>
+inline uint64_t decode_column_varint_tagged(uint8_t const *bytes) {
+  /// Decode the body of a tagged varint, in the stream byte order
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  if constexpr(needs_byte_swap<T>) {
+    value = byte_swap(value);
+  }
+  return value;
+}
+
+template<varint_codec Codec>
+inline uint8_t const *decode_column_varint(uint8_t const *bytes, uint8_t const *end, uint64_t &value) {
+  /// Decode one varint of a column straight from memory, returning the end of
+  /// what was read, or nullptr if it runs past the end or is malformed
+  if(bytes == end) {                                                            // a column holding fewer varints than its record count
+    return nullptr;
+  }
+  if constexpr(Codec == varint_codec::LEB128) {
+    value = 0;
+    for(size_t i = 0; bytes != end; ++i) {
+      uint8_t const byte(*bytes++);
+      if(i == varint_size_max - 1 && byte > 1) {
+        return nullptr;
+      }
+      value |= static_cast<uint64_t>(byte & 0x7Fu) << (7 * i);
+      if(!(byte & 0x80u)) {
+        return bytes;
+      }
+    }
+    return nullptr;
+  } else if constexpr(Codec == varint_codec::PREFIX) {
+    size_t const size(varint_prefix_size_from_first(*bytes));
+    if(size > static_cast<size_t>(end - bytes)) {
+      return nullptr;
+    }
+    uint64_t rest{0};
+    for(size_t i = 1; i != size; ++i) {
+      rest |= static_cast<uint64_t>(bytes[i]) << (8 * (i - 1));
+    }
+    value = decode_varint_prefix(*bytes, rest, size);
+    return bytes + size;
+  } else {
+    uint8_t const first(*bytes);
+    if(first < 0x80) {
+      value = first;
+      return bytes + 1;
+    }
+    size_t const size(size_t{1} << (first & 0x03u));                            // 0x80 to 0x83 tag a uint8_t to a uint64_t
+    if(first > 0x83 || size >= static_cast<size_t>(end - bytes)) {
+      return nullptr;
+    }
+    switch(size) {
+    case sizeof(uint8_t):
+      value = bytes[1];
+      break;
+    case sizeof(uint16_t):
+      value = decode_column_varint_tagged<uint16_t>(bytes + 1);
+      break;
+    case sizeof(uint32_t):
+      value = decode_column_varint_tagged<uint32_t>(bytes + 1);
+      break;
+    default:
+      value = decode_column_varint_tagged<uint64_t>(bytes + 1);
+      break;
+    }
+    return bytes + 1 + size;
+  }
+}
+
+template<typename Function>
+inline void with_varint_codec(varint_codec const codec, Function &&function) {
+  /// Call function(std::integral_constant<varint_codec, codec>), so a loop
+  /// over a whole column is compiled once for each codec instead of choosing
+  /// the codec for every value
+  switch(codec) {
+  case varint_codec::LEB128:
+    function(std::integral_constant<varint_codec, varint_codec::LEB128>());
+    return;
+  case varint_codec::PREFIX:
+    function(std::integral_constant<varint_codec, varint_codec::PREFIX>());
+    return;
+  case varint_codec::TAGGED:
+    break;
+  }
+  function(std::integral_constant<varint_codec, varint_codec::TAGGED>());
+}
+
+}
+
+template<auto Member, column_encoding Encoding = detail::default_column_encoding<typename detail::column_member_traits<decltype(Member)>::value_type>()>
+struct column {
+  /// One member of a struct sent as a column of a batch
+  using class_type = typename detail::column_member_traits<decltype(Member)>::class_type;
+  using value_type = typename detail::column_member_traits<decltype(Member)>::value_type;
+  static_assert(Encoding != column_encoding::POD || is_pod_value<value_type>, "SerialStorm: only trivially copyable columns can be sent as pods");
+  static_assert((Encoding != column_encoding::VARINT && Encoding != column_encoding::DELTA) || (std::is_integral_v<value_type> && !std::is_same_v<value_type, bool>), "SerialStorm: only integer columns can be varint-packed");
+
+  static constexpr column_encoding encoding{Encoding};
+  static constexpr size_t wire_size_min{Encoding == column_encoding::POD ? sizeof(value_type) :
+                                        Encoding == column_encoding::VALUE ? (has_nonempty_encoding<value_type>::value ? 1 : 0) :
+                                        1};                                     // bytes each record takes in this column at the least, as every varint takes a byte
+
+  template<typename StreamT, typename Records>
+  static void write(StreamT &stream, Records const &records) {
+    /// Write this member of every record as a column
+    size_t const count(records.size());
+    if constexpr(Encoding == column_encoding::POD) {
+      constexpr size_t block_size{std::max(size_t{1}, 4096 / sizeof(value_type))}; // gather through a small stack buffer rather than allocating
+      value_type block[block_size];
+      for(size_t done = 0; done != count;) {
+        size_t const block_count(std::min(count - done, block_size));
+        for(size_t i = 0; i != block_count; ++i) {
+          block[i] = records[done + i].*Member;
+        }
+        stream.write_pod_array(block, block_count);
+        done += block_count;
+      }
+    } else if constexpr(Encoding == column_encoding::VALUE) {
+      for(size_t i = 0; i != count; ++i) {
+        stream.write_value(records[i].*Member);
+      }
+    } else {
+      std::vector<char> buffer(count * varint_size_max);                        // room for the longest encoding of every value, owned by this call as writing it may yield to another coroutine on this thread
+      auto *const begin(reinterpret_cast<uint8_t*>(buffer.data()));
+      uint8_t *end(begin);
+      detail::with_varint_codec(stream.get_varint_codec(), [&](auto const codec){
+        using unsigned_type = std::make_unsigned_t<value_type>;
+        value_type previous{};
+        for(size_t i = 0; i != count; ++i) {
+          value_type const value(records[i].*Member);
+          if constexpr(Encoding == column_encoding::DELTA) {
+            end = detail::encode_column_varint<codec>(detail::zigzag_encode(static_cast<std::make_signed_t<value_type>>(static_cast<unsigned_type>(static_cast<unsigned_type>(value) - static_cast<unsigned_type>(previous)))), end); // wraps, so any difference fits
+            previous = value;
+          } else {
+            end = detail::encode_column_varint<codec>(detail::zigzag_encode(value), end);
+          }
+        }
+      });
+      buffer.resize(static_cast<size_t>(end - begin));
+      stream.write_varint(buffer.size());
+      stream.write_pod_array(buffer.data(), buffer.size());
+    }
+  }
+
+  template<typename StreamT>
+  static void read(StreamT const &stream, class_type *records, size_t const count, [[maybe_unused]] size_t const length_max) {
+    /// Read a column into this member of every record
+    if constexpr(Encoding == column_encoding::POD) {
+      constexpr size_t block_size{std::max(size_t{1}, 4096 / sizeof(value_type))};
+      value_type block[block_size];
+      for(size_t done = 0; done != count;) {
+        size_t const block_count(std::min(count - done, block_size));
+        stream.read_pod_array(block, block_count);
+        for(size_t i = 0; i != block_count; ++i) {
+          records[done + i].*Member = block[i];
+        }
+        done += block_count;
+      }
+    } else if constexpr(Encoding == column_encoding::VALUE) {
+      for(size_t i = 0; i != count; ++i) {
+        records[i].*Member = stream.template read_value<value_type>(length_max);
+      }
+    } else {
+      size_t const length(stream.template read_varint<size_t>());
+      if(count > length) {                                                      // every varint takes at least a byte
+        std::stringstream ss;
+        ss << "SerialStorm: Column of " << count << " varints can't fit in " << length << " bytes";
+        REPORT_ERROR_NORETURN
+      }
+      stream.check_read_budget(length);
+      stream.check_allocation(length);
+      std::vector<char, default_init_allocator<char>> buffer(length); // owned by this call, as reading into it may yield to another coroutine on this thread
+      stream.read_pod_array(buffer.data(), length);
+      auto const *bytes(reinterpret_cast<uint8_t const*>(buffer.data()));
+      auto const *const end(bytes + length);
+      detail::with_varint_codec(stream.get_varint_codec(), [&](auto const codec){
+        using unsigned_type = std::make_unsigned_t<value_type>;
+        value_type previous{};
+        for(size_t i = 0; i != count; ++i) {
+          uint64_t encoded;
+          bytes = detail::decode_column_varint<codec>(bytes, end, encoded);
+          if(!bytes) {
+            std::stringstream ss;
+            ss << "SerialStorm: Column of " << count << " varints is malformed or overruns its declared length of " << length << " bytes at value " << i;
+            REPORT_ERROR_NORETURN
+          }
+          unsigned_type const value(cast_if_required<unsigned_type>(encoded));
+          if constexpr(Encoding == column_encoding::DELTA) {
+            previous = static_cast<value_type>(static_cast<unsigned_type>(static_cast<unsigned_type>(previous) + static_cast<unsigned_type>(detail::zigzag_decode<std::make_signed_t<value_type>>(value))));
+            records[i].*Member = previous;
+          } else {
+            records[i].*Member = detail::zigzag_decode<value_type>(value);
+          }
+        }
+      });
+      if(bytes != end) {
+        std::stringstream ss;
+        ss << "SerialStorm: Column of " << count << " varints declared a length of " << length << " but took " << (length - static_cast<size_t>(end - bytes));
+        REPORT_ERROR_NORETURN
+      }
+    }
+  }
+};
+
+template<typename... Columns>
+class columns {
+  /// An array of structs sent as a columnar batch, described by the columns to send:
+  ///   using snapshot_batch = columns<column<&entity::id, column_encoding::DELTA>,
+  ///                                  column<&entity::position>,
+  ///                                  column<&entity::name>>;
+  static_assert(sizeof...(Columns) != 0, "SerialStorm: a columnar batch must have at least one column");
+  using class_type = typename std::tuple_element_t<0, std::tuple<Columns...>>::class_type;
+  static_assert((std::is_same_v<typename Columns::class_type, class_type> && ...), "SerialStorm: every column of a batch must be a member of the same type");
+
+  static constexpr size_t wire_size_min{(Columns::wire_size_min + ...)};
+
+public:
+  template<typename StreamT, typename Records>
+  static inline void write(StreamT &stream, Records const &records) {
+    /// Write a batch of records, from anything with size() and operator[]
+    /// such as a std::vector, as a record count and then each column
+    stream.write_varint(records.size());
+    (Columns::write(stream, records), ...);
+  }
+
+  template<typename StreamT, typename Allocator>
+  static void read_into(StreamT const &stream, std::vector<class_type, Allocator> &records, size_t const length_max = 0) {
+    /// Read a batch of records, replacing the contents of a vector, and
+    /// optionally limiting the number of records and the length of every
+    /// string and container read to prevent overflow or DOS attacks.
+    /// Members without a column are value initialised
+    size_t const count(stream.template read_varint<size_t>());
+    if(length_max != 0 && count > length_max) {                                 // optionally limit the record count to a safe maximum
+      std::stringstream ss;
+      ss << "SerialStorm: Columnar batch of " << count << " records exceeded the permitted maximum of " << length_max;
+      REPORT_ERROR_NORETURN
+    }
+    if constexpr(wire_size_min != 0) {
+      if(count > stream.read_budget_remaining() / wire_size_min) {
+        std::stringstream ss;
+        ss << "SerialStorm: Columnar batch of " << count << " records exceeded the remaining decode budget of " << stream.read_budget_remaining() << " bytes";
+        REPORT_ERROR_NORETURN
+      }
+    }
+    stream.check_allocation(count, sizeof(class_type));
+    records.clear();
+    records.resize(count);
+    (Columns::read(stream, records.data(), count, length_max), ...);
+  }
+
+  template<typename StreamT>
+  static inline std::vector<class_type> read(StreamT const &stream, size_t const length_max = 0) {
+    /// Read a batch of records into a new vector
+    std::vector<class_type> records;
+    read_into(stream, records, length_max);
+    return records;
+  }
+};
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+/// Byte order handling.  The byte order used on the wire is a compile-time
+/// switch, like the debug verification switches: define
+/// SERIALSTORM_BYTE_ORDER as LITTLE, BIG or NATIVE (the default) before
+/// including any SerialStorm header.  When the wire byte order matches the
+/// host, no byte swapping code is generated at all.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#ifdef __SSSE3__
+  #include <tmmintrin.h>
+#endif // __SSSE3__
+#ifdef _MSC_VER
+  #include <cstdlib>
+#endif // _MSC_VER
+
+#ifndef SERIALSTORM_BYTE_ORDER
+  #define SERIALSTORM_BYTE_ORDER NATIVE
+#endif // SERIALSTORM_BYTE_ORDER
+
+namespace serialstorm {
+
+enum class byte_order : uint8_t {
+  LITTLE,
+  BIG,
+  #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    NATIVE = BIG
+  #else
+    NATIVE = LITTLE
+  #endif
+};
+
+inline constexpr byte_order stream_byte_order{byte_order::SERIALSTORM_BYTE_ORDER}; // byte order used on the wire for pods and varints
+
+template<typename T>
+inline constexpr bool is_byte_swappable{(std::is_arithmetic_v<T> || std::is_enum_v<T>) && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)}; // structs are sent as-is, as their layout is unknown
+
+template<typename T>
+inline constexpr bool needs_byte_swap{stream_byte_order != byte_order::NATIVE && is_byte_swappable<T>};
+
+namespace detail {
+
+template<size_t Size> struct unsigned_of_size;
+template<> struct unsigned_of_size<2> { using type = uint16_t; };
+template<> struct unsigned_of_size<4> { using type = uint32_t; };
+template<> struct unsigned_of_size<8> { using type = uint64_t; };
+
+inline uint16_t byte_swap_unsigned(uint16_t const value) {
+  #ifdef _MSC_VER
+    return _byteswap_ushort(value);
+  #else
+    return __builtin_bswap16(value);
+  #endif // _MSC_VER
+}
+inline uint32_t byte_swap_unsigned(uint32_t const value) {
+  #ifdef _MSC_VER
+    return _byteswap_ulong(value);
+  #else
+    return __builtin_bswap32(value);
+  #endif // _MSC_VER
+}
+inline uint64_t byte_swap_unsigned(uint64_t const value) {
+  #ifdef _MSC_VER
+    return _byteswap_uint64(value);
+  #else
+    return __builtin_bswap64(value);
+  #endif // _MSC_VER
+}
+
+}
+
+template<typename T>
+inline T byte_swap(T const &value) {
+  /// Reverse the byte order of an arithmetic or enum value
+  static_assert(is_byte_swappable<T>, "SerialStorm: only multi-byte arithmetic and enum types can be byte swapped");
+  typename detail::unsigned_of_size<sizeof(T)>::type bits;
+  std::memcpy(&bits, &value, sizeof(T));                                        // go via an unsigned integer so floats are never handled with their bytes reversed
+  bits = detail::byte_swap_unsigned(bits);
+  T result;
+  std::memcpy(&result, &bits, sizeof(T));
+  return result;
+}
+
+template<typename T>
+inline void byte_swap_array(T const *source, T *dest, size_t const count) {
+  /// Reverse the byte order of each of an array of arithmetic or enum values,
+  /// sixteen bytes at a time where SSSE3 is available.  Source and
+  /// destination may be the same.
+  static_assert(is_byte_swappable<T>, "SerialStorm: only multi-byte arithmetic and enum types can be byte swapped");
+  auto const *source_bytes(reinterpret_cast<unsigned char const*>(source));
+  auto *dest_bytes(reinterpret_cast<unsigned char*>(dest));
+  size_t i{0};
+  #ifdef __SSSE3__
+    __m128i const mask(sizeof(T) == 2 ? _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1) :
+                       sizeof(T) == 4 ? _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3) :
+                                        _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7));
+    constexpr size_t per_vector{16 / sizeof(T)};
+    for(; i + per_vector <= count; i += per_vector) {
+      __m128i const vector(_mm_loadu_si128(reinterpret_cast<__m128i const*>(source_bytes + i * sizeof(T))));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest_bytes + i * sizeof(T)), _mm_shuffle_epi8(vector, mask));
+    }
+  #endif // __SSSE3__
+  for(; i != count; ++i) {                                                      // scalar tail, or the whole array without SSSE3 - compilers will often vectorise this anyway
+    typename detail::unsigned_of_size<sizeof(T)>::type bits;
+    std::memcpy(&bits, source_bytes + i * sizeof(T), sizeof(T));
+    bits = detail::byte_swap_unsigned(bits);
+    std::memcpy(dest_bytes + i * sizeof(T), &bits, sizeof(T));
+  }
+}
+
+template<typename T>
+inline constexpr void encode_stream_order(T const value, uint8_t *bytes) {
+  /// Store an unsigned integer's bytes in the stream byte order with shifts
+  /// rather than a copy, so it can run in a constant expression; compilers
+  /// reduce it to a single store, byte swapped where needed, at run time
+  static_assert(std::is_unsigned_v<T>, "SerialStorm: only unsigned integers can be encoded by shifting");
+  for(size_t i = 0; i != sizeof(T); ++i) {
+    size_t const shift(8 * (stream_byte_order == byte_order::LITTLE ? i : sizeof(T) - 1 - i));
+    bytes[i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> shift);
+  }
+}
+
+}
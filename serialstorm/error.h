@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace serialstorm {
+
+enum class errc : uint8_t {                                                     // error conditions reported by the non-throwing try_read functions
+  NONE = 0,                                                                     // success
+  BAD_VARINT_SIZE,                                                              // varint size byte is not in the protocol
+  LENGTH_EXCEEDED,                                                              // declared length is greater than the permitted maximum
+  SHORT_READ,                                                                   // the stream ended before all the requested data was read
+  STREAM_ERROR,                                                                 // the underlying stream reported some other failure
+  VERIFICATION_FAILED,                                                          // debug verification header or footer did not match
+  BUDGET_EXCEEDED,                                                              // the stream's decode budget or allocation limit would be exceeded
+  TIMEOUT                                                                       // the stream's read deadline passed before the data arrived
+};
+
+class error_category_impl : public std::error_category {
+  /// Error category to allow errc to be used as a std::error_code
+public:
+  char const *name() const noexcept override {
+    return "serialstorm";
+  }
+
+  std::string message(int const condition) const override {
+    switch(static_cast<errc>(condition)) {
+    case errc::NONE:
+      return "success";
+    case errc::BAD_VARINT_SIZE:
+      return "varint size is not in the protocol";
+    case errc::LENGTH_EXCEEDED:
+      return "length exceeded the permitted maximum";
+    case errc::SHORT_READ:
+      return "short read on stream";
+    case errc::STREAM_ERROR:
+      return "stream error";
+    case errc::VERIFICATION_FAILED:
+      return "verification failed";
+    case errc::BUDGET_EXCEEDED:
+      return "decode budget exceeded";
+    case errc::TIMEOUT:
+      return "read deadline expired";
+    }
+    return "unknown error";
+  }
+};
+
+inline std::error_category const &error_category() noexcept {
+  /// Access the singleton SerialStorm error category
+  static error_category_impl const instance;
+  return instance;
+}
+
+inline std::error_code make_error_code(errc const error) noexcept {
+  /// Convert a SerialStorm error condition to a std::error_code
+  return {static_cast<int>(error), error_category()};
+}
+
+template<typename T>
+class result {
+  /// Value or error returned by the non-throwing try_read functions, in the
+  /// style of std::expected.  Never allocates and never throws on its own.
+  T data{};
+  errc error_code{errc::NONE};
+
+public:
+  constexpr result(T new_data) noexcept(std::is_nothrow_move_constructible_v<T>)
+    : data(std::move(new_data)) {
+    /// Construct a successful result holding a value
+  }
+  constexpr result(errc const new_error) noexcept(std::is_nothrow_default_constructible_v<T>)
+    : error_code(new_error) {
+    /// Construct a failed result holding an error
+  }
+
+  constexpr bool has_value() const noexcept {
+    return error_code == errc::NONE;
+  }
+  constexpr explicit operator bool() const noexcept {
+    return has_value();
+  }
+
+  constexpr errc error() const noexcept {
+    /// Report the error, or errc::NONE if this result holds a value
+    return error_code;
+  }
+
+  constexpr T &value() & noexcept {
+    /// Access the value; only meaningful if has_value() is true
+    return data;
+  }
+  constexpr T const &value() const & noexcept {
+    return data;
+  }
+  constexpr T &&value() && noexcept {
+    return std::move(data);
+  }
+
+  constexpr T &operator*() & noexcept {
+    return data;
+  }
+  constexpr T const &operator*() const & noexcept {
+    return data;
+  }
+  constexpr T *operator->() noexcept {
+    return &data;
+  }
+  constexpr T const *operator->() const noexcept {
+    return &data;
+  }
+};
+
+}
+
+namespace std {
+
+template<>
+struct is_error_code_enum<serialstorm::errc> : true_type {};
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+/// Broadcasting a shared_message to many asio sockets.  Each connection keeps
+/// its own queue of messages to send, each a reference to the one shared
+/// encoded buffer behind an optional small prefix encoded for that connection
+/// alone, such as a sequence number.  Queued messages are sent with
+/// asynchronous gather writes, several at a time where they have built up, so
+/// the cost of a broadcast to each subscriber is a queue entry and its prefix,
+/// whatever the size of the message.
+
+#include <boost/asio/basic_stream_socket.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "shared_message.h"
+#include "stream_memory.h"
+
+namespace serialstorm {
+
+namespace detail {
+
+struct const_buffer_range {
+  /// View of an array of asio buffers as a buffer sequence, so an
+  /// asynchronous write holds it without copying the array it refers to
+  boost::asio::const_buffer const *first;
+  boost::asio::const_buffer const *last;
+
+  boost::asio::const_buffer const *begin() const {
+    return first;
+  }
+  boost::asio::const_buffer const *end() const {
+    return last;
+  }
+};
+
+}
+
+template<typename SocketType>
+class fanout_connection {
+  /// Send queue of shared messages for one socket.  Must only be used from
+  /// the thread running the socket's io_context, or its strand, and must
+  /// outlive any write in progress, so keep it alive until the socket is
+  /// closed and its handlers have run
+  struct queued_message {
+    std::string prefix;                                                         // small enough for the short string optimisation, so never allocated
+    shared_message message;
+  };
+
+  static constexpr size_t batch_max{64};                                        // messages per gather write, well under any system's iovec limit
+
+  boost::asio::basic_stream_socket<SocketType> &socket;
+  std::deque<queued_message> queue;                                             // references stay valid as messages are added behind a write in progress
+  std::vector<boost::asio::const_buffer> gather;                                // reused between writes so its capacity is only allocated once
+  size_t in_flight{0};                                                          // messages at the front of the queue being written now
+  uint64_t message_count{0};                                                    // messages ever queued, for per-connection sequence numbers
+  boost::system::error_code write_error;
+
+public:
+  explicit fanout_connection(boost::asio::basic_stream_socket<SocketType> &this_socket)
+    : socket(this_socket) {
+    /// Specific constructor
+  }
+
+  fanout_connection(fanout_connection const&) = delete;
+  fanout_connection &operator=(fanout_connection const&) = delete;
+
+  inline void send(shared_message const &message) {
+    /// Queue a shared message to be sent as it is
+    push(std::string(), message);
+  }
+
+  template<typename Function>
+  inline void send(shared_message const &message, Function &&prefix) {
+    /// Queue a shared message to be sent behind a prefix for this connection
+    /// alone, encoded now by calling prefix(stream_memory<std::string>&)
+    std::string encoded_prefix;
+    stream_memory<std::string> writer(encoded_prefix);
+    prefix(writer);
+    push(std::move(encoded_prefix), message);
+  }
+
+  inline uint64_t sequence() const {
+    /// Report the number of messages queued on this connection so far; while
+    /// a prefix is being encoded, this is the number of the message it's for
+    return message_count;
+  }
+
+  inline size_t pending() const {
+    /// Report the number of messages queued or being written, to spot slow subscribers
+    return queue.size();
+  }
+
+  inline boost::system::error_code const &error() const {
+    /// Report the error that stopped this connection sending, if any.  Once a
+    /// write fails, everything queued is discarded and later sends are ignored
+    return write_error;
+  }
+
+private:
+  inline void push(std::string &&prefix, shared_message const &message) {
+    /// Add a message to the queue, and start writing if nothing is in progress
+    if(write_error) {
+      return;
+    }
+    queue.push_back(queued_message{std::move(prefix), message});
+    ++message_count;
+    if(in_flight == 0) {
+      write_next();
+    }
+  }
+
+  void write_next() {
+    /// Write as many queued messages as fit in one gather write
+    in_flight = std::min(queue.size(), batch_max);
+    gather.clear();
+    for(size_t i = 0; i != in_flight; ++i) {
+      queued_message const &queued(queue[i]);
+      if(!queued.prefix.empty()) {
+        gather.emplace_back(queued.prefix.data(), queued.prefix.size());
+      }
+      gather.emplace_back(queued.message.view().data(), queued.message.size());
+    }
+    boost::asio::async_write(socket, detail::const_buffer_range{gather.data(), gather.data() + gather.size()}, [this](boost::system::error_code const &error, size_t){
+      queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(in_flight)); // drops this connection's references to the shared messages
+      in_flight = 0;
+      if(error) {
+        write_error = error;
+        queue.clear();
+        return;
+      }
+      if(!queue.empty()) {
+        write_next();
+      }
+    });
+  }
+};
+
+namespace detail {
+
+template<typename T, typename = void>
+struct is_dereferenceable : std::false_type {};
+template<typename T>
+struct is_dereferenceable<T, std::void_t<decltype(*std::declval<T&>())>> : std::true_type {};
+
+template<typename T>
+inline auto &fanout_connection_of(T &element) {
+  /// Access a connection held directly, or through a pointer or smart pointer
+  if constexpr(is_dereferenceable<T>::value) {
+    return *element;
+  } else {
+    return element;
+  }
+}
+
+}
+
+template<typename Connections>
+inline void broadcast(shared_message const &message, Connections &connections) {
+  /// Queue a shared message on every connection in a range of connections, or
+  /// pointers to them
+  for(auto &element : connections) {
+    detail::fanout_connection_of(element).send(message);
+  }
+}
+
+template<typename Connections, typename Function>
+inline void broadcast(shared_message const &message, Connections &connections, Function &&prefix) {
+  /// Queue a shared message on every connection in a range, each behind its
+  /// own prefix encoded by calling prefix(connection, stream_memory<std::string>&)
+  for(auto &element : connections) {
+    auto &connection(detail::fanout_connection_of(element));
+    connection.send(message, [&](auto &writer){
+      prefix(connection, writer);
+    });
+  }
+}
+
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+/// Writing received data straight to a file descriptor, for the read_blob and
+/// read_varblob overloads which take one.  On Linux, data arriving on a
+/// socket is moved to the file with splice() through a pipe, so it never
+/// passes through user space.  Elsewhere, or where either end can't splice,
+/// it is staged through a single reusable page-aligned buffer per thread and
+/// written with pwrite().  POSIX only.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "stream_base.h"
+
+namespace serialstorm {
+namespace detail {
+
+inline constexpr size_t fd_staging_size{1024 * 1024};                           // size of the staging buffer, and of the pipe used for splicing where the system allows
+inline constexpr size_t fd_staging_alignment{4096};                             // page aligned, so the buffer also suits files opened with O_DIRECT
+
+struct fd_staging_delete {
+  void operator()(char *buffer) const {
+    ::operator delete(buffer, std::align_val_t{fd_staging_alignment});
+  }
+};
+using fd_staging_ptr = std::unique_ptr<char, fd_staging_delete>;
+
+inline fd_staging_ptr make_fd_staging_buffer() {
+  /// Allocate a page-aligned staging buffer, for callers which may yield
+  /// while holding it and so can't share the per-thread one
+  return fd_staging_ptr(static_cast<char*>(::operator new(fd_staging_size, std::align_val_t{fd_staging_alignment})));
+}
+
+inline char *fd_staging_buffer() {
+  /// Reusable page-aligned staging buffer, allocated once per thread on first
+  /// use.  Only for use by calls which never yield while holding it
+  thread_local fd_staging_ptr const buffer(make_fd_staging_buffer());
+  return buffer.get();
+}
+
+class fd_sink {
+  /// Destination file descriptor, written at an explicit offset which
+  /// advances as data is written, or at its current position if the offset
+  /// is negative, as it must be for pipes and sockets
+  int const fd;
+  int64_t offset;
+  /// bytes splice_from() has taken from the socket, counted before they are
+  /// written on, so a caller can account for them if writing them fails
+  size_t received{0};
+
+public:
+  fd_sink(int const this_fd, int64_t const this_offset)
+    : fd(this_fd),
+      offset(this_offset) {
+    /// Specific constructor
+  }
+
+  inline size_t spliced() const {
+    /// Bytes splice_from() has taken from the socket so far, including any
+    /// that failed to reach the file descriptor
+    return received;
+  }
+
+  inline void preallocate([[maybe_unused]] size_t const length) const {
+    /// Reserve space for length more bytes up front where the filesystem
+    /// supports it, so the file is laid out contiguously and a full disk is
+    /// reported before anything is received
+    #ifdef __linux__
+      off_t const start(offset >= 0 ? static_cast<off_t>(offset) : ::lseek(fd, 0, SEEK_CUR));
+      if(start < 0 || length == 0) {                                            // not seekable, such as a pipe, so there's nothing to reserve
+        return;
+      }
+      if(::fallocate(fd, 0, start, static_cast<off_t>(length)) != 0 && errno == ENOSPC) { // anything else just means the filesystem can't, which is harmless
+        report_error("preallocating space for a blob");
+      }
+    #endif // __linux__
+  }
+
+  inline void write(char const *data, size_t size) {
+    /// Write a block of data to the file descriptor in full
+    while(size != 0) {
+      ssize_t const written(offset >= 0 ? ::pwrite(fd, data, size, static_cast<off_t>(offset)) : ::write(fd, data, size));
+      if(written < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        report_error("writing a blob to a file descriptor");
+        return;
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+      if(offset >= 0) {
+        offset += written;
+      }
+    }
+  }
+
+  template<typename WaitFunction>
+  inline size_t splice_from([[maybe_unused]] int const socket_fd,
+                            [[maybe_unused]] size_t const length,
+                            [[maybe_unused]] WaitFunction &&wait_readable) {
+    /// Move up to length bytes from a socket to the file descriptor through a
+    /// pipe, without copying them through user space, calling wait_readable()
+    /// whenever a non-blocking socket has nothing to read yet, which returns
+    /// false to give up.  Returns the number of bytes moved, all of which have
+    /// reached the file descriptor, and which is less than length only if the
+    /// socket can't be spliced from, the wait gave up or reading the socket
+    /// failed or hit its end, in which case the caller must move the rest by
+    /// reading the socket itself, which reports any short read or error
+    #ifdef __linux__
+      int pipe_fds[2];
+      if(::pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        return 0;
+      }
+      struct pipe_closer {
+        int const *fds;
+        ~pipe_closer() {
+          ::close(fds[0]);
+          ::close(fds[1]);
+        }
+      } const closer{pipe_fds};
+      ::fcntl(pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(fd_staging_size));    // best effort, as unprivileged processes may be limited to less
+      int const pipe_size(::fcntl(pipe_fds[1], F_GETPIPE_SZ));
+      size_t const chunk_max(pipe_size > 0 ? static_cast<size_t>(pipe_size) : 65536);
+      bool file_splice{true};                                                   // cleared if the destination turns out not to support splice
+      size_t moved{0};
+      while(moved != length) {
+        ssize_t const in(::splice(socket_fd, nullptr, pipe_fds[1], nullptr, std::min(length - moved, chunk_max), SPLICE_F_MOVE | SPLICE_F_MORE));
+        if(in < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EAGAIN) {
+            if(!wait_readable()) {
+              return moved;
+            }
+            continue;
+          }
+          if(moved == 0 && (errno == EINVAL || errno == ENOSYS)) {              // this socket can't be spliced from, so leave it all to the caller
+            return 0;
+          }
+          return moved;                                                         // the caller's own read of the socket reports the error
+        }
+        if(in == 0) {                                                           // the connection closed, which the caller's own read reports as a short read
+          return moved;
+        }
+        received += static_cast<size_t>(in);
+        drain_pipe(pipe_fds[0], static_cast<size_t>(in), file_splice);
+        moved += static_cast<size_t>(in);
+      }
+      return moved;
+    #else
+      return 0;
+    #endif // __linux__
+  }
+
+private:
+  #ifdef __linux__
+    inline void drain_pipe(int const pipe_fd, size_t size, bool &file_splice) {
+      /// Move everything in the pipe to the file descriptor, falling back to
+      /// copying through the staging buffer if it can't be spliced to
+      while(size != 0) {
+        if(!file_splice) {
+          ssize_t const in(::read(pipe_fd, fd_staging_buffer(), std::min(size, fd_staging_size)));
+          if(in < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            report_error("reading a blob back from a pipe");
+            return;
+          }
+          write(fd_staging_buffer(), static_cast<size_t>(in));
+          size -= static_cast<size_t>(in);
+          continue;
+        }
+        loff_t file_offset(offset);
+        ssize_t const out(::splice(pipe_fd, nullptr, fd, offset >= 0 ? &file_offset : nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE));
+        if(out < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EINVAL || errno == ENOSYS) {                              // such as a file opened with O_APPEND, or a filesystem without splice
+            file_splice = false;
+            continue;
+          }
+          report_error("splicing a blob to a file descriptor");
+          return;
+        }
+        size -= static_cast<size_t>(out);
+        if(offset >= 0) {
+          offset = file_offset;
+        }
+      }
+    }
+  #endif // __linux__
+
+  static inline void report_error(char const *action) {
+    /// Report a failed system call, with the reason given by errno
+    std::stringstream ss;
+    ss << "SerialStorm: " << action << " failed: " << std::strerror(errno);
+    REPORT_ERROR_NORETURN
+  }
+};
+
+}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+/// Parallel chunked serialisation of large datasets.  The caller splits the
+/// data into chunks; each chunk is encoded by a worker thread into its own
+/// memory stream, and the results are written to the underlying stream in
+/// order, preceded by the chunk count and a table of chunk lengths as varints.
+/// When reading, the whole chunked block is read from the stream at once and
+/// the chunks are then decoded concurrently.  Encode and decode functions may
+/// be called on any thread, in any order, and must only touch data belonging
+/// to the chunk they are given.
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "stream_memory.h"
+
+namespace serialstorm {
+
+using chunk_writer = stream_memory<std::vector<char>>;                          // stream each chunk is encoded into
+using chunk_reader = stream_memory<std::string_view>;                           // stream each chunk is decoded from, viewing the shared block read
+
+namespace detail {
+
+template<typename Function>
+inline void run_parallel(size_t const job_count, unsigned int thread_count, Function &&function) {
+  /// Call function(job_index) for each job, spread across up to thread_count
+  /// threads including the calling thread (0 for one per hardware thread).
+  /// Once any job throws, no more jobs are started, and the first exception
+  /// is rethrown on the calling thread after all threads have finished
+  if(thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::atomic<size_t> job_next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker([&]{
+    for(size_t job = job_next++; job < job_count && !failed; job = job_next++) {
+      try {
+        function(job);
+      } catch(...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if(!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  });
+  std::vector<std::thread> threads;
+  size_t const thread_count_used(std::min(static_cast<size_t>(thread_count), job_count));
+  if(thread_count_used > 1) {
+    threads.reserve(thread_count_used - 1);
+    for(size_t i = 1; i != thread_count_used; ++i) {
+      try {
+        threads.emplace_back(worker);
+      } catch(std::system_error const&) {                                        // carry on with the threads we have if no more can be started
+        break;
+      }
+    }
+  }
+  worker();                                                                     // the calling thread takes a share of the work too
+  for(auto &thread : threads) {
+    thread.join();
+  }
+  if(error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}
+
+template<typename StreamT, typename Function>
+inline void write_chunks_parallel(StreamT &stream,
+                                  size_t const chunk_count,
+                                  Function &&encode,
+                                  unsigned int const thread_count = 0) {
+  /// Encode chunk_count chunks in parallel by calling
+  /// encode(chunk_index, chunk_writer&) for each, then write them to the
+  /// stream in order with a length table
+  std::vector<std::vector<char>> buffers(chunk_count);
+  detail::run_parallel(chunk_count, thread_count, [&](size_t const chunk) {
+    chunk_writer writer(buffers[chunk]);
+    encode(chunk, writer);
+  });
+  stream.write_varint(chunk_count);
+  for(auto const &buffer : buffers) {
+    stream.write_varint(buffer.size());
+  }
+  for(auto const &buffer : buffers) {
+    stream.write_pod_array(buffer.data(), buffer.size());
+  }
+}
+
+template<typename StreamT, typename Function>
+inline void read_chunks_parallel(StreamT const &stream,
+                                 Function &&decode,
+                                 size_t const chunk_count_max = 0,
+                                 size_t const length_max = 0,
+                                 unsigned int const thread_count = 0) {
+  /// Read a block written by write_chunks_parallel and decode its chunks in
+  /// parallel by calling decode(chunk_index, chunk_reader&) for each.
+  /// Optionally limit the number of chunks, and the total length in bytes of
+  /// all chunks, to prevent overflow or DOS attacks
+  size_t const chunk_count(stream.template read_varint<size_t>());
+  if(chunk_count_max != 0 && chunk_count > chunk_count_max) {                   // optionally limit the chunk count to a safe maximum
+    std::stringstream ss;
+    ss << "SerialStorm: Chunk count " << chunk_count << " exceeded the permitted maximum of " << chunk_count_max;
+    REPORT_ERROR_NORETURN
+  }
+  std::vector<size_t> offsets;                                                  // not reserved up front, as the count may not be limited
+  size_t length_total{0};
+  for(size_t i = 0; i != chunk_count; ++i) {
+    size_t const length(stream.template read_varint<size_t>());
+    size_t const length_limit(length_max == 0 ? std::numeric_limits<size_t>::max() : length_max);
+    if(length > length_limit - length_total) {                                  // always check, as a hostile length table could otherwise wrap the total
+      std::stringstream ss;
+      ss << "SerialStorm: Chunked block length exceeded the permitted maximum of " << length_limit;
+      REPORT_ERROR_NORETURN
+    }
+    offsets.emplace_back(length_total);
+    length_total += length;
+  }
+  offsets.emplace_back(length_total);
+  stream.check_read_budget(length_total);                                       // before allocating, so the stream's decode budget and allocation limit apply to the whole block
+  stream.check_allocation(length_total);
+  std::vector<char, default_init_allocator<char>> block(length_total);
+  stream.read_pod_array(block.data(), block.size());
+  detail::run_parallel(chunk_count, thread_count, [&](size_t const chunk) {
+    std::string_view view(block.data() + offsets[chunk], offsets[chunk + 1] - offsets[chunk]);
+    chunk_reader reader(view);
+    reader.set_allocation_max(stream.get_allocation_max());                     // each chunk is bounded by the block, but what it decodes into is not
+    decode(chunk, reader);
+  });
+}
+
+}
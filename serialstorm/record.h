@@ -0,0 +1,269 @@
+#pragma once
+
+/// Tagged records: an optional self-describing format for structs whose
+/// layout changes over time, so old and new readers and writers can talk to
+/// each other without upgrading in lockstep.  Each field is sent as a varint
+/// key, holding its tag and wire type, followed by its value, and the record
+/// ends with a zero key.  Readers dispatch known tags through a jump table
+/// generated at compile time, skip fields with tags they don't know, and
+/// leave fields that weren't sent untouched.  Empty optional members aren't
+/// sent at all.  Nothing else in the library uses this format, so untagged
+/// serialisation keeps its density wherever the layout is fixed.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "stream_memory.h"
+
+namespace serialstorm {
+
+enum class wire_type : uint8_t {                                                // how a field's value is sent, and how to skip it if the tag is unknown
+  VARINT,                                                                       // unsigned integers, as a varint
+  FIXED8,                                                                       // any other pod value of 1, 2, 4 or 8 bytes, as a pod
+  FIXED16,
+  FIXED32,
+  FIXED64,
+  LENGTH_DELIMITED                                                              // anything else, as a varint length and then the value: strings are sent as varstrings
+};
+
+inline constexpr uint32_t record_tag_max{255};                                  // the largest field tag, as the jump table has an entry for every tag up to the largest used
+
+namespace detail {
+
+template<typename T> struct member_pointer_traits;
+template<typename Class, typename T> struct member_pointer_traits<T Class::*> {
+  using class_type = Class;
+  using value_type = T;
+};
+
+template<typename T> struct unwrap_optional {
+  using type = T;
+};
+template<typename T> struct unwrap_optional<std::optional<T>> {
+  using type = T;
+};
+
+template<typename T>
+inline constexpr wire_type wire_type_of() {
+  /// Choose the wire type a value of this type is sent with
+  if constexpr(std::is_integral_v<T> && std::is_unsigned_v<T> && !std::is_same_v<T, bool>) {
+    return wire_type::VARINT;
+  } else if constexpr(is_pod_value<T> && sizeof(T) == 1) {
+    return wire_type::FIXED8;
+  } else if constexpr(is_pod_value<T> && sizeof(T) == 2) {
+    return wire_type::FIXED16;
+  } else if constexpr(is_pod_value<T> && sizeof(T) == 4) {
+    return wire_type::FIXED32;
+  } else if constexpr(is_pod_value<T> && sizeof(T) == 8) {
+    return wire_type::FIXED64;
+  } else {
+    return wire_type::LENGTH_DELIMITED;
+  }
+}
+
+template<uint32_t... Tags>
+inline constexpr bool tags_unique() {
+  /// Report whether no tag appears more than once
+  std::array<uint32_t, sizeof...(Tags)> tags{Tags...};
+  for(size_t i = 0; i != tags.size(); ++i) {
+    for(size_t j = i + 1; j != tags.size(); ++j) {
+      if(tags[i] == tags[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}
+
+template<typename StreamT>
+inline void skip_record_field(StreamT const &stream, uint64_t const key) {
+  /// Skip the value of a field from its key, without knowing its type.  Seeks
+  /// past fixed size and length-delimited values where the stream can
+  switch(static_cast<wire_type>(key & 0b111u)) {
+  case wire_type::VARINT:
+    stream.template read_varint<uint64_t>();
+    return;
+  case wire_type::FIXED8:
+    stream.skip(1);
+    return;
+  case wire_type::FIXED16:
+    stream.skip(2);
+    return;
+  case wire_type::FIXED32:
+    stream.skip(4);
+    return;
+  case wire_type::FIXED64:
+    stream.skip(8);
+    return;
+  case wire_type::LENGTH_DELIMITED:
+    stream.skip(stream.template read_varint<size_t>());
+    return;
+  }
+  std::stringstream ss;
+  ss << "SerialStorm: Record field " << (key >> 3) << " has unknown wire type " << (key & 0b111u);
+  REPORT_ERROR_NORETURN
+}
+
+template<uint32_t Tag, auto Member>
+struct field {
+  /// One member of a struct sent in a tagged record, with a tag which must
+  /// never be reused for anything else once in service
+  using class_type = typename detail::member_pointer_traits<decltype(Member)>::class_type;
+  using member_type = typename detail::member_pointer_traits<decltype(Member)>::value_type;
+  using value_type = typename detail::unwrap_optional<member_type>::type;       // the type sent, as empty optionals aren't sent at all
+  static_assert(Tag != 0, "SerialStorm: record field tag 0 is reserved to mark the end of a record");
+
+  static constexpr uint32_t tag{Tag};
+  static constexpr wire_type wire{detail::wire_type_of<value_type>()};
+  static constexpr uint64_t key{(uint64_t{Tag} << 3) | static_cast<uint64_t>(wire)};
+
+  template<typename StreamT>
+  static inline void write(StreamT &stream, class_type const &object) {
+    /// Write this field's key and value from the object, if it has one
+    if constexpr(is_std_optional<member_type>::value) {
+      if(object.*Member) {
+        write_value(stream, *(object.*Member));
+      }
+    } else {
+      write_value(stream, object.*Member);
+    }
+  }
+
+  template<typename StreamT>
+  static void read(StreamT const &stream, class_type &object, size_t const length_max) {
+    /// Read this field's value into the object, once its key has been read
+    if constexpr(wire == wire_type::VARINT) {
+      object.*Member = stream.template read_varint<value_type>();
+    } else if constexpr(wire != wire_type::LENGTH_DELIMITED) {
+      object.*Member = stream.template read_pod<value_type>();
+    } else if constexpr(is_std_string<value_type>::value) {
+      object.*Member = stream.template read_varstring<value_type>(length_max);
+    } else {
+      size_t const length(stream.template read_varint<size_t>());
+      size_t const start(stream.tellp());
+      typename StreamT::scoped_read_budget const budget(stream, length);       // so a malformed value fails at its end rather than reading into the next field
+      value_type value(stream.template read_value<value_type>(length_max));
+      if(stream.tellp() - start != length) {                                    // the value must fill the length exactly, or the stream is now out of step
+        std::stringstream ss;
+        ss << "SerialStorm: Record field " << Tag << " declared a length of " << length << " but its value took " << (stream.tellp() - start);
+        REPORT_ERROR_NORETURN
+      }
+      object.*Member = std::move(value);
+    }
+  }
+
+private:
+  template<typename StreamT>
+  static inline void write_value(StreamT &stream, value_type const &value) {
+    /// Write this field's key and a value
+    stream.write_varint(key);
+    if constexpr(wire == wire_type::VARINT) {
+      stream.write_varint(value);
+    } else if constexpr(wire != wire_type::LENGTH_DELIMITED) {
+      stream.write_pod(value);
+    } else if constexpr(is_std_string<value_type>::value) {
+      stream.write_varstring(value);                                            // a varstring is already length-delimited, so needs no second length
+    } else {
+      std::vector<char> buffer;                                                 // owned by this call rather than shared per thread, as the write below may yield to another coroutine on this thread
+      stream_memory<std::vector<char>> payload(buffer);
+      payload.set_varint_codec(stream.get_varint_codec());
+      payload.write_value(value);
+      stream.write_varint(buffer.size());
+      stream.write_pod_array(buffer.data(), buffer.size());
+    }
+  }
+};
+
+template<typename... Fields>
+class record {
+  /// A struct sent as a tagged record, described by the fields to send:
+  ///   using player_record = record<field<1, &player::id>,
+  ///                                field<2, &player::name>>;
+  static_assert(sizeof...(Fields) != 0, "SerialStorm: a record must have at least one field");
+  using class_type = typename std::tuple_element_t<0, std::tuple<Fields...>>::class_type;
+  static_assert((std::is_same_v<typename Fields::class_type, class_type> && ...), "SerialStorm: every field of a record must be a member of the same type");
+  static_assert(detail::tags_unique<Fields::tag...>(), "SerialStorm: record field tags must be unique");
+  static_assert(((Fields::tag <= record_tag_max) && ...), "SerialStorm: record field tags must be no more than record_tag_max, to keep the jump table small");
+
+  static constexpr uint32_t tag_max{std::max({Fields::tag...})};                // the jump table has an entry for every tag up to this
+
+  template<typename StreamT>
+  using field_reader = void(*)(StreamT const&, class_type&, size_t);
+
+  template<typename StreamT>
+  static constexpr std::array<field_reader<StreamT>, tag_max + 1> make_readers() {
+    /// Build the jump table from tag to field reader, with gaps left empty
+    std::array<field_reader<StreamT>, tag_max + 1> readers{};
+    ((readers[Fields::tag] = &Fields::template read<StreamT>), ...);
+    return readers;
+  }
+  static constexpr std::array<uint64_t, tag_max + 1> make_keys() {
+    /// Build the table from tag to the full key expected, including the wire type
+    std::array<uint64_t, tag_max + 1> keys{};
+    ((keys[Fields::tag] = Fields::key), ...);
+    return keys;
+  }
+
+public:
+  template<typename StreamT>
+  static inline void write(StreamT &stream, class_type const &object) {
+    /// Write an object as a tagged record
+    static_assert(!verification_enabled<StreamT>, "SerialStorm: tagged records can't be skipped reliably with debug verification enabled");
+    (Fields::write(stream, object), ...);
+    stream.write_varint(uint64_t{0});                                           // end of record
+  }
+
+  template<typename StreamT>
+  static void read_into(StreamT const &stream, class_type &object, size_t const length_max = 0) {
+    /// Read a tagged record into an existing object, leaving members whose
+    /// fields weren't sent unchanged, and optionally limiting the length of
+    /// every string and container read to prevent overflow or DOS attacks
+    static_assert(!verification_enabled<StreamT>, "SerialStorm: tagged records can't be skipped reliably with debug verification enabled");
+    static constexpr std::array<field_reader<StreamT>, tag_max + 1> readers{make_readers<StreamT>()};
+    static constexpr std::array<uint64_t, tag_max + 1> keys{make_keys()};
+    for(;;) {
+      uint64_t const key(stream.template read_varint<uint64_t>());
+      if(key == 0) {                                                            // end of record
+        return;
+      }
+      uint64_t const tag(key >> 3);
+      if(tag > tag_max || !readers[tag]) {                                      // a field added since this reader was built, or since retired
+        skip_record_field(stream, key);
+        continue;
+      }
+      if(key != keys[tag]) {
+        std::stringstream ss;
+        ss << "SerialStorm: Record field " << tag << " has wire type " << (key & 0b111u) << " but this reader expects " << (keys[tag] & 0b111u);
+        REPORT_ERROR_NORETURN
+      }
+      readers[tag](stream, object, length_max);
+    }
+  }
+
+  template<typename StreamT>
+  static inline class_type read(StreamT const &stream, size_t const length_max = 0) {
+    /// Read a tagged record into a new default-constructed object
+    class_type object{};
+    read_into(stream, object, length_max);
+    return object;
+  }
+
+private:
+  template<typename StreamT>
+  static constexpr bool verification_enabled{                                   // dependent on the stream type, so it only fails if used
+    #ifdef SERIALSTORM_DEBUG_VERIFY
+      sizeof(StreamT) != 0
+    #else
+      sizeof(StreamT) == 0
+    #endif // SERIALSTORM_DEBUG_VERIFY
+  };
+};
+
+}
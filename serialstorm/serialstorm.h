@@ -6,3 +6,14 @@
 #include "stream_asio_sync.h"
 #include "stream_asio_async.h"
 #include "stream_std_stream.h"
+#include "stream_memory.h"
+#include "stream_shm_ring.h"
+#include "stream_datagram.h"
+#include "parallel.h"
+#include "writer_queue.h"
+#include "shared_message.h"
+#include "static_message.h"
+#include "fanout.h"
+#include "bit_stream.h"
+#include "record.h"
+#include "columns.h"
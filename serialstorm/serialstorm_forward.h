@@ -8,6 +8,15 @@ class stream_base;
 template<typename StreamT>
 class stream_std_stream;
 
+template<typename StreamT>
+class stream_memory;
+
+template<typename RingT>
+class stream_shm_ring;
+
+template<typename SocketT>
+class stream_datagram;
+
 template<typename SocketType>
 class stream_asio_sync;
 
@@ -0,0 +1,62 @@
+#pragma once
+
+/// Messages serialised once and shared, immutable, between many streams, for
+/// broadcasting the same data to many connections without encoding it again
+/// for each.  Copies share the one encoded buffer by reference count, which
+/// is freed when the last stream is done with it.
+
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "stream_memory.h"
+
+namespace serialstorm {
+
+class shared_message {
+  std::shared_ptr<std::vector<char> const> encoded;
+
+public:
+  shared_message() = default;
+
+  explicit shared_message(std::vector<char> &&data)
+    : encoded(std::make_shared<std::vector<char> const>(std::move(data))) {
+    /// Take ownership of an already serialised message
+  }
+
+  template<typename Function>
+  static inline shared_message encode(Function &&function) {
+    /// Serialise a message once by calling function(stream_memory<std::vector<char>>&),
+    /// straight into the buffer that is shared, so function may itself encode
+    /// other messages
+    thread_local size_t size_hint{0};                                           // the last message's size, so similar messages are allocated once rather than grown
+    std::vector<char> buffer;
+    buffer.reserve(size_hint);
+    stream_memory<std::vector<char>> writer(buffer);
+    function(writer);
+    size_hint = buffer.size();
+    return shared_message(std::move(buffer));
+  }
+
+  inline bool empty() const {
+    /// Report whether there is nothing to send
+    return !encoded || encoded->empty();
+  }
+
+  inline size_t size() const {
+    /// Report the size of the encoded message in bytes
+    return encoded ? encoded->size() : 0;
+  }
+
+  inline std::string_view view() const {
+    /// Access the encoded message, valid for as long as any copy of this is alive
+    return encoded ? std::string_view(encoded->data(), encoded->size()) : std::string_view();
+  }
+
+  inline long use_count() const {
+    /// Report how many copies share the encoded message, such as one per connection it is still queued on
+    return encoded.use_count();
+  }
+};
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+/// Messages encoded at compile time, for handshake headers, protocol magic
+/// and other messages that never change.  The message is written by a
+/// function using the same encoding as the streams, including every varint
+/// codec, into a constant std::array<std::byte, N> with N deduced from what
+/// was written, so sending it is a single write_buffer of a constant:
+///   constexpr auto handshake(serialstorm::encode_static([](auto &writer){
+///     writer.write_pod(uint32_t{0x53544F52});
+///     writer.write_varint(protocol_version);
+///     writer.write_varstring("serialstorm");
+///   }));
+///   stream.write_buffer(handshake.data(), handshake.size());
+/// The function must be a lambda with no captures, as it is called once to
+/// measure the message and once to encode it.  Static messages hold no
+/// verification markers, so are not readable in verification mode.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#if __cplusplus >= 202002L
+  #include <bit>
+#endif
+#include "endian.h"
+#include "varint.h"
+
+namespace serialstorm {
+
+template<size_t Capacity>
+class static_encoder {
+  /// Writer for the subset of the stream writing functions that can run in a
+  /// constant expression.  With a capacity of zero, it only measures
+  std::array<std::byte, Capacity> bytes{};
+  size_t size_used{0};
+  varint_codec varint_codec_used;
+
+public:
+  constexpr explicit static_encoder(varint_codec const codec = varint_codec::TAGGED)
+    : varint_codec_used(codec) {
+    /// Specific constructor
+  }
+
+  template<typename T>
+  constexpr void write_pod(T const value) {
+    /// Write an integer, enum or bool in the stream byte order, or with C++20,
+    /// a floating point value
+    if constexpr(std::is_enum_v<T>) {
+      write_pod(static_cast<std::underlying_type_t<T>>(value));
+    } else if constexpr(std::is_same_v<T, bool>) {
+      write_pod(static_cast<uint8_t>(value));
+    } else if constexpr(std::is_integral_v<T>) {
+      uint8_t encoded[sizeof(T)]{};
+      encode_stream_order(static_cast<std::make_unsigned_t<T>>(value), encoded);
+      write_bytes(encoded, sizeof(T));
+    } else {
+      #ifdef __cpp_lib_bit_cast
+        static_assert(std::is_floating_point_v<T>, "SerialStorm: only integers, enums, bools and floating point values can be encoded at compile time");
+        write_pod(std::bit_cast<typename detail::unsigned_of_size<sizeof(T)>::type>(value));
+      #else
+        static_assert(!std::is_floating_point_v<T>, "SerialStorm: floating point values can only be encoded at compile time with C++20");
+        static_assert(std::is_floating_point_v<T>, "SerialStorm: only integers, enums and bools can be encoded at compile time");
+      #endif // __cpp_lib_bit_cast
+    }
+  }
+
+  template<typename T, class = typename std::enable_if<std::is_unsigned<T>::value>::type>
+  constexpr void write_varint(T const uint) {
+    /// Write a variable-length unsigned integer in the codec this was made with
+    uint8_t encoded[varint_size_max]{};
+    switch(varint_codec_used) {
+    case varint_codec::LEB128:
+      write_bytes(encoded, encode_varint_leb128(uint, encoded));
+      return;
+    case varint_codec::PREFIX:
+      write_bytes(encoded, encode_varint_prefix(uint, encoded));
+      return;
+    case varint_codec::TAGGED:
+      break;
+    }
+    write_bytes(encoded, encode_varint_tagged(uint, encoded));
+  }
+
+  constexpr void write_string(std::string_view const string) {
+    /// Write a bare string
+    /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    for(char const c : string) {
+      uint8_t const byte(static_cast<uint8_t>(c));
+      write_bytes(&byte, 1);
+    }
+  }
+
+  constexpr void write_varstring(std::string_view const string) {
+    /// Write a string prefixed with its length as a varint
+    write_varint(string.size());
+    write_string(string);
+  }
+
+  constexpr size_t size() const {
+    /// Report the number of bytes written so far
+    return size_used;
+  }
+
+  constexpr std::array<std::byte, Capacity> const &data() const {
+    /// Access the encoded message
+    return bytes;
+  }
+
+private:
+  constexpr void write_bytes(uint8_t const *data, size_t const size) {
+    /// Append encoded bytes, or just count them when measuring
+    if constexpr(Capacity != 0) {
+      for(size_t i = 0; i != size; ++i) {
+        bytes[size_used + i] = static_cast<std::byte>(data[i]);                 // out of range is a compile error, as it isn't a constant expression
+      }
+    }
+    size_used += size;
+  }
+};
+
+template<varint_codec Codec = varint_codec::TAGGED, typename Function>
+constexpr auto encode_static(Function function) {
+  /// Encode a message at compile time by calling function(static_encoder&),
+  /// with varints in the given codec, into a std::array sized to fit
+  constexpr size_t size{[](Function measure){
+    static_encoder<0> encoder(Codec);
+    measure(encoder);
+    return encoder.size();
+  }(function)};
+  static_encoder<size> encoder(Codec);
+  function(encoder);
+  return encoder.data();
+}
+
+}
@@ -4,8 +4,14 @@
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
 #include <boost/asio/spawn.hpp>
 #include "stream_base.h"
+#include <algorithm>
+#include <array>
+#ifndef _WIN32
+  #include "fd_sink.h"
+#endif // _WIN32
 
 namespace serialstorm {
 
@@ -30,25 +36,81 @@ public:
   }
 
   template<typename T>
-  std::string read_string(T const stringlength) const {
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the stream to the target buffer asynchronously, reporting errors instead of throwing
+    boost::system::error_code error;
+    boost::asio::async_read(socket, boost::asio::buffer(data, size), yield[error]);
+    if(error) {
+      return error == boost::asio::error::eof ? errc::SHORT_READ : errc::STREAM_ERROR;
+    }
+    return errc::NONE;
+  }
+
+  void skip_bytes(size_t size) const {
+    /// Discard a block of data of the specified size from the stream asynchronously; sockets can't seek, so it is read in pieces
+    std::array<char, 4096> discard;
+    for(; size != 0; size -= std::min(size, discard.size())) {
+      boost::asio::async_read(socket, boost::asio::buffer(discard.data(), std::min(size, discard.size())), yield);
+    }
+  }
+
+  #ifndef _WIN32
+    void read_blob_to_fd(int const fd, size_t const size, int64_t const offset) const {
+      /// Read a block of data of the specified size from the stream straight to
+      /// a file descriptor asynchronously, spliced in the kernel where possible
+      detail::fd_sink sink(fd, offset);
+      sink.preallocate(size);
+      size_t remaining(size);
+      {
+        struct non_blocking_restorer {
+          boost::asio::basic_stream_socket<SocketType> &socket;
+          bool const previous;
+          ~non_blocking_restorer() {
+            boost::system::error_code error;
+            socket.native_non_blocking(previous, error);                        // best effort, as a destructor must not throw
+          }
+        } const restorer{socket, socket.native_non_blocking()};                 // restores the socket's own mode however the splice ends
+        socket.native_non_blocking(true);                                       // so splice never blocks the thread, and waits by yielding instead
+        remaining -= sink.splice_from(socket.native_handle(), size, [&]{
+          socket.async_wait(boost::asio::socket_base::wait_read, yield);
+          return true;
+        });
+      }
+      if(remaining == 0) {
+        return;
+      }
+      detail::fd_staging_ptr const buffer(detail::make_fd_staging_buffer());    // the socket can't splice, so stage it through a buffer of this call's own, as other coroutines on this thread may run while it yields
+      while(remaining != 0) {
+        size_t const chunk(std::min(remaining, detail::fd_staging_size));
+        read_buffer(buffer.get(), chunk);
+        sink.write(buffer.get(), chunk);
+        remaining -= chunk;
+      }
+    }
+  #endif // _WIN32
+
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
     /// Read size bytes from the stream into a string asynchronously
-    #ifdef NDEBUG
-      std::string string(stringlength, '\0');                                   // use null byte as default fill to minimise risk in release mode
-    #else
-      std::string string(stringlength, '?');                                    // use ? as a marker character to visibly show if we somehow end up with a short read
-    #endif
-    read_buffer(&string[0], string.size());                                     // copy-less string-filling buffer hack from http://stackoverflow.com/a/19623133/1678468
-    return string;
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      read_buffer(data, size);
+    });
   }
 
-  template<typename T, typename SizeT>
-  std::vector<T> read_blob(SizeT const size) const {
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
     /// Read size bytes from the stream into a vector blob asynchronously
-    std::vector<T> blob(size);
+    std::vector<T, Allocator> blob(size, allocator);
     read_buffer(blob.data(), blob.size() * sizeof(T));
     return blob;
   }
 
+  template<typename T>
+  static inline size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of an asio native buffer sequence, for position tracking
+    return boost::asio::buffer_size(buffer);
+  }
+
   template<typename T>
   inline void write_buffer(T const &buffer) {
     /// Write an asio native buffer (or whatever fits in its place) to the stream asynchronously
@@ -60,8 +122,19 @@ public:
     write_buffer(boost::asio::buffer(data, size));
   }
 
-  template<typename T>
-  inline void write_string(std::basic_string<T> const &string) {
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Write a sequence of contiguous buffers to the stream asynchronously in a single gather write
+    std::vector<boost::asio::const_buffer> sequence;
+    sequence.reserve(buffers.size());
+    for(auto const &buffer : buffers) {
+      sequence.emplace_back(buffer.data(), buffer.size());
+    }
+    boost::asio::async_write(socket, sequence, yield);
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
     /// Write a string to the stream asynchronously
     write_buffer(boost::asio::buffer(string));
   }
@@ -4,7 +4,19 @@
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
 #include "stream_base.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <vector>
+#ifndef _WIN32
+  #include <poll.h>
+  #include "fd_sink.h"
+#endif // _WIN32
 
 namespace serialstorm {
 
@@ -12,43 +24,138 @@ template<typename SocketType>
 class stream_asio_sync : public stream_base<SocketType, stream_asio_sync> {
   /// Stream handler to manage a asynchronous boost::asio stream
 public:
+  using clock = std::chrono::steady_clock;
+
   boost::asio::basic_stream_socket<SocketType> &socket;
 
+private:
+  clock::time_point deadline{clock::time_point::max()};                         // reads fail once this passes, for the whole stream
+  clock::duration timeout{clock::duration::zero()};                             // each read from the socket fails after this long, if not zero
+  mutable std::vector<char> unread;                                             // what arrived of a read that timed out, returned first by the next read
+
+public:
   constexpr stream_asio_sync(boost::asio::basic_stream_socket<SocketType> &this_socket)
     : socket(this_socket) {
     /// Specific constructor
   }
 
+  void set_deadline(clock::time_point const new_deadline) {
+    /// Make reads fail with a timeout once a point in time passes, or never
+    /// with clock::time_point::max(), the default.  A compound read, such as a
+    /// varstring, which times out part way can't be retried, so the stream
+    /// must then be closed
+    deadline = new_deadline;
+    update_non_blocking();
+  }
+  template<typename Rep, typename Period>
+  void set_timeout(std::chrono::duration<Rep, Period> const new_timeout) {
+    /// Make each read from the socket fail with a timeout if it doesn't
+    /// complete in time, or never with zero, the default
+    timeout = std::chrono::duration_cast<clock::duration>(new_timeout);
+    update_non_blocking();
+  }
+
+  clock::time_point get_deadline() const {
+    return deadline;
+  }
+  clock::duration get_timeout() const {
+    return timeout;
+  }
+
   template<typename T>
   void read_buffer(T *data, size_t const size) const {
     /// Read a block of data of the specified size from the stream to the target buffer synchronously
-    boost::asio::read(socket, boost::asio::buffer(data, size));
+    if(boost::system::error_code const error = read_exactly(reinterpret_cast<char*>(data), size); error) {
+      throw boost::system::system_error(error);
+    }
   }
 
   template<typename T>
-  std::string read_string(T const stringlength) const {
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the stream to the target buffer synchronously, reporting errors instead of throwing
+    if(boost::system::error_code const error = read_exactly(reinterpret_cast<char*>(data), size); error) {
+      return error == boost::asio::error::eof ? errc::SHORT_READ : error == boost::asio::error::timed_out ? errc::TIMEOUT : errc::STREAM_ERROR;
+    }
+    return errc::NONE;
+  }
+
+  void skip_bytes(size_t const size) const {
+    /// Discard a block of data of the specified size from the stream synchronously; sockets can't seek, so it is read in pieces.
+    /// If this times out, what was already discarded is counted by tellp(), so the rest can be skipped by another skip
+    std::array<char, 4096> discard;
+    size_t remaining(size);
+    try {
+      for(; remaining != 0; remaining -= std::min(remaining, discard.size())) {
+        read_buffer(discard.data(), std::min(remaining, discard.size()));
+      }
+    } catch(...) {
+      this->count_partial_read(size - remaining);
+      throw;
+    }
+  }
+
+  #ifndef _WIN32
+    void read_blob_to_fd(int const fd, size_t const size, int64_t const offset) const {
+      /// Read a block of data of the specified size from the stream straight to
+      /// a file descriptor synchronously, spliced in the kernel where possible
+      /// If this times out, what already reached the file descriptor is
+      /// counted by tellp(), so the rest can be read by another read_blob
+      detail::fd_sink sink(fd, offset);
+      sink.preallocate(size);
+      size_t remaining(size);
+      size_t staged{0};                                                         // bytes read through the staging buffer, counted as soon as they leave the socket
+      try {
+        if(unread.empty()) {                                                    // anything left from a read that timed out must go first, so stage it all
+          clock::time_point const expiry(operation_deadline());
+          boost::system::error_code error;
+          remaining -= sink.splice_from(socket.native_handle(), size, [&]{
+            error = wait_for(POLLIN, expiry);
+            return !error;
+          });
+          if(error) {
+            throw boost::system::system_error(error);
+          }
+        }
+        for(char *const buffer = detail::fd_staging_buffer(); remaining != 0;) { // the socket can't splice, so stage it through the reusable buffer
+          size_t const chunk(std::min(remaining, detail::fd_staging_size));
+          read_buffer(buffer, chunk);                                           // a chunk which times out keeps what arrived of it in unread
+          staged += chunk;
+          sink.write(buffer, chunk);
+          remaining -= chunk;
+        }
+      } catch(...) {
+        this->count_partial_read(sink.spliced() + staged);
+        throw;
+      }
+    }
+  #endif // _WIN32
+
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
     /// Read size bytes from the stream into a string synchronously
-    #ifdef NDEBUG
-      std::string string(stringlength, '\0');                                   // use null byte as default fill to minimise risk in release mode
-    #else
-      std::string string(stringlength, '?');                                    // use ? as a marker character to visibly show if we somehow end up with a short read
-    #endif
-    read_buffer(&string[0], string.size());                                     // copy-less string-filling buffer hack from http://stackoverflow.com/a/19623133/1678468
-    return string;
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      read_buffer(data, size);
+    });
   }
 
-  template<typename T, typename SizeT>
-  std::vector<T> read_blob(SizeT const size) const {
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
     /// Read size bytes from the stream into a vector blob synchronously
-    std::vector<T> blob(size);
+    std::vector<T, Allocator> blob(size, allocator);
     read_buffer(blob.data(), blob.size() * sizeof(T));
     return blob;
   }
 
+  template<typename T>
+  static inline size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of an asio native buffer sequence, for position tracking
+    return boost::asio::buffer_size(buffer);
+  }
+
   template<typename T>
   inline void write_buffer(T const &buffer) {
     /// Write an asio native buffer (or whatever fits in its place) to the stream synchronously
-    boost::asio::write(socket, buffer);
+    write_all(buffer);
   }
   template<typename T>
   inline void write_buffer(T const *data, size_t const size) {
@@ -56,8 +163,19 @@ public:
     write_buffer(boost::asio::buffer(data, size));
   }
 
-  template<typename T>
-  inline void write_string(std::basic_string<T> const &string) {
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Write a sequence of contiguous buffers to the stream synchronously in a single gather write
+    std::vector<boost::asio::const_buffer> sequence;
+    sequence.reserve(buffers.size());
+    for(auto const &buffer : buffers) {
+      sequence.emplace_back(buffer.data(), buffer.size());
+    }
+    write_all(sequence);
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
     /// Write a string to the stream synchronously
     write_buffer(boost::asio::buffer(string));
   }
@@ -72,6 +190,121 @@ public:
     /// Write a blob of specific size to the stream synchronously
     write_buffer(boost::asio::buffer(blob, size));
   }
+
+private:
+  inline bool has_deadline() const {
+    return deadline != clock::time_point::max() || timeout != clock::duration::zero();
+  }
+
+  inline clock::time_point operation_deadline() const {
+    /// Work out when a read starting now must give up
+    if(timeout == clock::duration::zero()) {
+      return deadline;
+    }
+    return std::min(deadline, clock::now() + timeout);
+  }
+
+  void update_non_blocking() {
+    /// Keep the socket non-blocking while there is a deadline, so reads can
+    /// wait for it with poll rather than blocking indefinitely
+    socket.non_blocking(has_deadline());
+  }
+
+  boost::system::error_code read_exactly(char *data, size_t const size) const {
+    /// Read exactly size bytes, first from anything left over from a read
+    /// that timed out.  If this one times out, what arrived of it is kept to
+    /// be returned first by the next, so the stream stays in step with
+    /// tellp() and the read can be retried
+    size_t done(std::min(size, unread.size()));
+    if(done != 0) {
+      std::copy(unread.begin(), unread.begin() + static_cast<std::ptrdiff_t>(done), data);
+      unread.erase(unread.begin(), unread.begin() + static_cast<std::ptrdiff_t>(done));
+    }
+    boost::system::error_code error;
+    if(done == size) {
+      return error;
+    }
+    if(!has_deadline()) {
+      boost::asio::read(socket, boost::asio::buffer(data + done, size - done), error);
+      return error;
+    }
+    clock::time_point const expiry(operation_deadline());
+    while(done != size) {
+      done += socket.read_some(boost::asio::buffer(data + done, size - done), error);
+      if(error == boost::asio::error::would_block) {
+        error = wait_for(POLLIN, expiry);
+      }
+      if(error) {
+        break;
+      }
+    }
+    if(error == boost::asio::error::timed_out) {
+      unread.assign(data, data + done);
+    }
+    return error;
+  }
+
+  template<typename Buffers>
+  void write_all(Buffers const &buffers) {
+    /// Write a buffer sequence in full synchronously
+    boost::system::error_code error;
+    size_t written(boost::asio::write(socket, buffers, error));
+    if(error == boost::asio::error::would_block) {                              // a read deadline leaves the socket non-blocking, so wait for room to write the rest, without a deadline
+      std::vector<boost::asio::const_buffer> remaining(boost::asio::buffer_sequence_begin(buffers), boost::asio::buffer_sequence_end(buffers));
+      for(;;) {
+        size_t done_count{0};
+        for(; done_count != remaining.size() && written >= remaining[done_count].size(); ++done_count) {
+          written -= remaining[done_count].size();
+        }
+        remaining.erase(remaining.begin(), remaining.begin() + static_cast<std::ptrdiff_t>(done_count));
+        if(remaining.empty()) {
+          error.clear();
+          break;
+        }
+        remaining.front() += written;
+        error = wait_for(POLLOUT, clock::time_point::max());
+        if(error) {
+          break;
+        }
+        written = boost::asio::write(socket, remaining, error);
+        if(error != boost::asio::error::would_block) {
+          break;
+        }
+      }
+    }
+    if(error) {
+      throw boost::system::system_error(error);
+    }
+  }
+
+  boost::system::error_code wait_for(short const events, clock::time_point const expiry) const {
+    /// Wait with poll until the socket is ready or the deadline passes
+    for(;;) {
+      int wait_ms(-1);
+      if(expiry != clock::time_point::max()) {
+        clock::time_point const now(clock::now());
+        if(now >= expiry) {
+          return boost::asio::error::timed_out;
+        }
+        wait_ms = static_cast<int>(std::min<clock::rep>(std::chrono::ceil<std::chrono::milliseconds>(expiry - now).count(), INT_MAX));
+      }
+      pollfd descriptor{socket.native_handle(), events, 0};
+      #ifdef _WIN32
+        int const result(::WSAPoll(&descriptor, 1, wait_ms));
+        if(result < 0) {
+          return boost::system::error_code(::WSAGetLastError(), boost::system::system_category());
+        }
+      #else
+        int const result(::poll(&descriptor, 1, wait_ms));
+        if(result < 0 && errno != EINTR) {
+          return boost::system::error_code(errno, boost::system::system_category());
+        }
+      #endif // _WIN32
+      if(result > 0) {
+        return {};                                                              // ready, or an error or hangup for the next read or write to report
+      }
+    }
+  }
 };
 
 }
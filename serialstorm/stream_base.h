@@ -5,6 +5,16 @@
 #include <stdexcept>
 #include <limits>
 #include "cast_if_required.h"
+#include "endian.h"
+#include "error.h"
+#include "stream_stats.h"
+#include "string_dictionary.h"
+#include "type_traits.h"
+#include "uninitialised.h"
+#include "varint.h"
+#ifdef SERIALSTORM_TRACE
+  #include "trace.h"
+#endif // SERIALSTORM_TRACE
 
 #if defined(SERIALSTORM_DEBUG_VERIFY_POD) || defined(SERIALSTORM_DEBUG_VERIFY_STRING) || defined(SERIALSTORM_DEBUG_VERIFY_BUFFER) || defined(SERIALSTORM_DEBUG_VERIFY_BLOB)
   #define SERIALSTORM_DEBUG_VERIFY
@@ -39,6 +49,13 @@ class stream_base {
   };
 
   mutable size_t read_pos{0};                                                   // tracked read position in the stream, for tellp() - independent of underlying stream
+  size_t write_pos{0};                                                          // tracked write position in the stream, for tellw() - independent of underlying stream
+  varint_codec varint_codec_used{varint_codec::TAGGED};                         // varint format used in both directions, which must match the other end
+  mutable size_t read_budget_end{std::numeric_limits<size_t>::max()};           // read position the decode budget runs out at, never less than read_pos, narrowed while reading a nested value
+  size_t allocation_max{0};                                                     // largest single allocation permitted for decoded data, or 0 for no limit
+  #ifdef SERIALSTORM_STATS
+    mutable stream_stats stats_data;                                            // per-stream operation counters, only present when instrumentation is enabled
+  #endif // SERIALSTORM_STATS
 
 public:
   // -------------------------- Status functions -------------------------------
@@ -46,19 +63,117 @@ public:
     /// Report read stream position, tracked independently of underlying stream
     return read_pos;
   }
+  size_t tellw() const {
+    /// Report write stream position, tracked independently of underlying stream
+    return write_pos;
+  }
+
+  varint_codec get_varint_codec() const {
+    /// Report the varint format this stream reads and writes
+    return varint_codec_used;
+  }
+  void set_varint_codec(varint_codec const codec) {
+    /// Choose the varint format this stream reads and writes from now on
+    varint_codec_used = codec;
+  }
+
+  // ------------------------- Decode budget functions -------------------------
+  // A budget caps the total bytes that can be read from now on, and an
+  // allocation limit caps the size of any single string, blob buffer or
+  // container decoded.  Both are checked against declared lengths before
+  // anything is allocated, so hostile input fails fast instead of exhausting
+  // memory.  Reads past either limit throw, or return errc::BUDGET_EXCEEDED.
+  void set_read_budget(size_t const bytes) {
+    /// Permit at most this many more bytes to be read, such as the size of a
+    /// message or of all the input a session is allowed
+    read_budget_end = bytes > std::numeric_limits<size_t>::max() - read_pos ? std::numeric_limits<size_t>::max() : read_pos + bytes;
+  }
+  void clear_read_budget() {
+    /// Remove any read budget
+    read_budget_end = std::numeric_limits<size_t>::max();
+  }
+  size_t read_budget_remaining() const {
+    /// Report the number of bytes left to read before the budget is exceeded
+    return read_budget_end - read_pos;
+  }
+
+  class scoped_read_budget {
+    /// Narrow a stream's read budget to the next bytes for as long as this
+    /// lives, such as while decoding a value of a declared length, so it can't
+    /// read on into whatever follows, then restore the budget it replaced
+    stream_base const &stream;
+    size_t const budget_end_saved;
+
+  public:
+    scoped_read_budget(stream_base const &this_stream, size_t const bytes)
+      : stream(this_stream),
+        budget_end_saved(this_stream.read_budget_end) {
+      /// Specific constructor
+      stream.check_read_budget(bytes);                                          // a declared length past the enclosing budget fails before anything is read
+      stream.read_budget_end = stream.read_pos + std::min(bytes, stream.read_budget_end - stream.read_pos); // never past the enclosing budget, even where errors don't throw
+    }
+    scoped_read_budget(scoped_read_budget const&) = delete;
+    scoped_read_budget &operator=(scoped_read_budget const&) = delete;
+    ~scoped_read_budget() {
+      stream.read_budget_end = budget_end_saved;
+    }
+  };
+
+  void set_allocation_max(size_t const bytes) {
+    /// Limit the size of any single allocation for decoded data; 0 for no limit
+    allocation_max = bytes;
+  }
+  size_t get_allocation_max() const {
+    /// Report the allocation limit for decoded data; 0 for no limit
+    return allocation_max;
+  }
+
+  inline void check_read_budget(size_t const size) const {
+    /// Refuse to go on if reading size more bytes would exceed the read budget
+    if(!within_read_budget(size)) {
+      std::stringstream ss;
+      ss << "SerialStorm: Read of " << size << " bytes exceeded the remaining decode budget of " << (read_budget_end - read_pos) << " bytes";
+      REPORT_ERROR_NORETURN
+    }
+  }
+  inline void check_allocation(size_t const count, size_t const element_size = 1) const {
+    /// Refuse to allocate count elements of element_size bytes for decoded
+    /// data if that would exceed the allocation limit
+    if(!within_allocation_max(count, element_size)) {
+      std::stringstream ss;
+      ss << "SerialStorm: Allocation of " << count << " elements of " << element_size << " bytes exceeded the permitted maximum of " << allocation_max << " bytes";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  #ifdef SERIALSTORM_STATS
+    stream_stats const &stats() const {
+      /// Report the operation and byte counters gathered on this stream so far
+      return stats_data;
+    }
+    void reset_stats() {
+      /// Zero the operation and byte counters on this stream
+      stats_data.reset();
+    }
+  #endif // SERIALSTORM_STATS
 
   // ------------------------- Reading functions -------------------------------
   template<typename T>
   void read_buffer(T *data, size_t const size) const {
     /// CRTP polymorphic buffer read function
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "B>", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    check_read_budget(size);
     static_cast<StreamT<StreamParam> const*>(this)->read_buffer(data, size);
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       check_verification("<B", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
     read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
   }
   template<typename T>
   void read_buffer(T *data) const {
@@ -75,64 +190,70 @@ public:
   template<typename T>
   inline T read_pod() const {
     /// Read a plain old data value from the stream
+    count_read(&stream_stats::direction::pod, sizeof(T));
+    return read_pod_unmetered<T>();
+  }
+
+  template<typename T>
+  inline void read_pod_array(T *data, size_t const count) const {
+    /// Read an array of plain old data values from the stream in one go,
+    /// converting the byte order of the whole array at once if required
     #ifdef SERIALSTORM_DEBUG_VERIFY_POD
       check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "P>", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_POD
-    T data;
-    read_buffer(&data);
+    read_buffer(data, count * sizeof(T));
     #ifdef SERIALSTORM_DEBUG_VERIFY_POD
       check_verification("<P", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_POD
-    return data;
+    if constexpr(needs_byte_swap<T>) {
+      byte_swap_array(data, data, count);
+    }
+    count_read(&stream_stats::direction::pod, count * sizeof(T));
   }
 
   template<typename T>
   inline T read_varint() const {
-    /// Read a variable-size unsigned integer from the stream
-    ///   Designed to work with uints only.  If our first byte is smaller than
-    ///   128, we simply read it as-is.  Otherwise we flip the sign bit on the
-    ///   first byte to get x, and read 2^x bytes as the uint, and try to fit it
-    ///   into the supplied template type (which may overflow).
-    uint8_t datasize(read_pod<uint8_t>());
-    if(datasize & static_cast<uint8_t>(varint_size::UINT_8)) {                  // uint8_t half-byte (128), sent on its own
-      switch(static_cast<varint_size>(datasize)) {
-      case varint_size::UINT_8:                                                 // read a uint8_t  (1 byte)
-        return cast_if_required<T>(read_pod<uint8_t>());
-      case varint_size::UINT_16:                                                // read a uint16_t (2 bytes)
-        return cast_if_required<T>(read_pod<uint16_t>());
-      case varint_size::UINT_32:                                                // read a uint32_t (4 bytes)
-        return cast_if_required<T>(read_pod<uint32_t>());
-      case varint_size::UINT_64:                                                // read a uint64_t (8 bytes)
-        return cast_if_required<T>(read_pod<uint64_t>());
-      #pragma GCC diagnostic push
-      #ifdef __clang__
-        #pragma GCC diagnostic ignored "-Wcovered-switch-default"
-      #endif // __clang__
-      default:                                                                  // unknown type, protocol error
-        std::stringstream ss;
-        ss << "SerialStorm: Varint size " << static_cast<uint64_t>(datasize) << " is not in the protocol";
-        REPORT_ERROR
-      #pragma GCC diagnostic push
-      }
-    } else {                                                                    // this isn't a data size, this is a nibble (half-byte) containing the value itself
-      return datasize;                                                          // the first byte is the value itself
+    /// Read a variable-size unsigned integer from the stream, in the format
+    /// chosen with set_varint_codec, and try to fit it into the supplied
+    /// template type (which may overflow)
+    switch(varint_codec_used) {
+    case varint_codec::LEB128:
+      return cast_if_required<T>(read_varint_leb128());
+    case varint_codec::PREFIX:
+      return cast_if_required<T>(read_varint_prefix());
+    case varint_codec::TAGGED:
+      break;
     }
+    return read_varint_tagged<T>();
   }
 
-  template<typename T>
-  std::string read_string(T stringlength) const {
-    /// CRTP polymorphic buffer read function: fill a string of the specified size from the stream
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T stringlength, typename StringT::allocator_type const &allocator = {}) const {
+    /// CRTP polymorphic buffer read function: fill a string of the specified
+    /// size from the stream, optionally of another string type such as
+    /// std::pmr::string, constructed with the given allocator
+    static_assert(is_std_string<StringT>::value && std::is_same_v<typename StringT::value_type, char>, "SerialStorm: strings can only be read into a std::basic_string of char");
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_STRING, static_cast<size_t>(stringlength));
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
       check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "S>", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_STRING
-    return static_cast<StreamT<StreamParam> const*>(this)->read_string(stringlength);
+    check_read_budget(static_cast<size_t>(stringlength));                       // before allocating, so a hostile length can't exhaust memory
+    check_allocation(static_cast<size_t>(stringlength));
+    StringT string(static_cast<StreamT<StreamParam> const*>(this)->template read_string<T, StringT>(stringlength, allocator));
     #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
       check_verification("<S", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_STRING
+    read_pos += string.size();
+    count_read(&stream_stats::direction::backend, string.size());
+    count_read(&stream_stats::direction::string, string.size());
+    return string;
   }
 
-  template<typename T>
-  inline std::string read_varstring_fixed(size_t const length_max = 0) const {
+  template<typename T, typename StringT = std::string>
+  inline StringT read_varstring_fixed(size_t const length_max = 0,
+                                      typename StringT::allocator_type const &allocator = {}) const {
     /// Read a varstring from the stream with the length type specified by the
     /// template parameter type, and optionally limit the string to a maximum
     /// length to prevent overflow or DOS attacks
@@ -142,10 +263,12 @@ public:
       ss << "SerialStorm: Fixed varstring length " << stringlength << " exceeded the permitted maximum of " << length_max;
       REPORT_ERROR
     }
-    return read_string(stringlength);
+    return read_string<T, StringT>(stringlength, allocator);
   }
 
-  inline std::string read_varstring(size_t const length_max = 0) const {
+  template<typename StringT = std::string>
+  inline StringT read_varstring(size_t const length_max = 0,
+                                typename StringT::allocator_type const &allocator = {}) const {
     /// Read a varstring from the stream with the size automatically determined
     /// from a varint and optionally limit the string to a maximum length to
     /// prevent overflow or DOS attacks
@@ -155,7 +278,29 @@ public:
       ss << "SerialStorm: Varstring length " << stringlength << " exceeded the permitted maximum of " << length_max;
       REPORT_ERROR
     }
-    return read_string(stringlength);
+    return read_string<size_t, StringT>(stringlength, allocator);
+  }
+
+  inline std::string_view read_varstring_interned(string_dictionary_reader &dictionary,
+                                                  size_t const length_max = 0) const {
+    /// Read a varstring sent with write_varstring_interned, returning a view of
+    /// the dictionary's copy of it, which remains valid until the dictionary is
+    /// cleared or destroyed.  Optionally limit the length of new strings
+    size_t const id(read_varint<size_t>());
+    if(id < dictionary.size()) {                                                // a string we've seen before
+      return dictionary[id];
+    }
+    if(id != dictionary.size()) {                                               // new strings must take the next id in sequence
+      std::stringstream ss;
+      ss << "SerialStorm: Interned string id " << id << " is not in the dictionary of " << dictionary.size() << " strings";
+      REPORT_ERROR
+    }
+    if(dictionary.full()) {
+      std::stringstream ss;
+      ss << "SerialStorm: Interned string dictionary exceeded the permitted maximum of " << dictionary.entries_max << " strings";
+      REPORT_ERROR
+    }
+    return dictionary.add(read_varstring(length_max));
   }
 
   inline void read_varblob(std::ostream &outstream,
@@ -177,7 +322,9 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
       check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "L>", __func__);
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
-    std::vector<char> buffer(std::min(datalength, buffer_max_size));            // size the buffer to the data length or max size, as appropriate
+    check_read_budget(datalength);                                              // fail before reading any of it, rather than part way through
+    count_read(&stream_stats::direction::blob, datalength);
+    std::vector<char, default_init_allocator<char>> buffer(std::min(datalength, buffer_max_size)); // size the buffer to the data length or max size, uninitialised as it is about to be overwritten
     for(; datalength != 0; datalength -= buffer.size()) {                       // if it takes more than one buffer fill to read the data, repeat
       buffer.resize(std::min(datalength, buffer_max_size));                     // shrink the buffer if there's not enough data left to fill it
       read_buffer(buffer.data(), buffer.size());                                // you can write to the vector data directly
@@ -188,11 +335,368 @@ public:
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
   }
 
+  inline void read_varblob(int const fd,
+                           size_t const length_max = 0,
+                           int64_t const offset = -1) const {
+    /// Read a sequence of binary data of arbitrary length straight to a file
+    /// descriptor, at the given offset or at its current position if negative
+    size_t const datalength(read_varint<size_t>());
+    if(length_max != 0 && datalength > length_max) {                            // optionally limit the info length to a safe maximum
+      std::stringstream ss;
+      ss << "SerialStorm: Binary blob length " << datalength << " exceeded the permitted maximum of " << length_max;
+      REPORT_ERROR_NORETURN
+    }
+    read_blob(fd, datalength, offset);
+  }
+  inline void read_blob(int const fd,
+                        size_t const datalength,
+                        int64_t const offset = -1) const {
+    /// CRTP polymorphic blob read function: read a sequence of binary data of
+    /// known length straight to a file descriptor, at the given offset or at
+    /// its current position if negative, preallocating space for it first.
+    /// Streams which support it move the data without staging it in user space
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, datalength);
+    #endif // SERIALSTORM_TRACE
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
+      check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "L>", __func__);
+    #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+    check_read_budget(datalength);
+    count_read(&stream_stats::direction::blob, datalength);
+    static_cast<StreamT<StreamParam> const*>(this)->read_blob_to_fd(fd, datalength, offset);
+    read_pos += datalength;
+    count_read(&stream_stats::direction::backend, datalength);
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
+      check_verification("<L", __func__);
+    #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+  }
+
+  inline void skip(size_t const size) const {
+    /// CRTP polymorphic skip function: discard a block of data of the
+    /// specified size from the stream, seeking past it where the stream can
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    check_read_budget(size);
+    static_cast<StreamT<StreamParam> const*>(this)->skip_bytes(size);
+    read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
+  }
+
+  // -------------------- Container reading functions --------------------------
+  template<typename T, typename Allocator = std::allocator<char>>
+  inline T read_value(size_t const length_max = 0,
+                      [[maybe_unused]] Allocator const &allocator = {}) const {
+    /// Read a value of any supported type from the stream, choosing the
+    /// encoding by type: strings as varstrings, standard containers and
+    /// vocabulary types with the functions below, and anything else trivially
+    /// copyable as a pod.  The length limit applies to every string and
+    /// container read, including nested ones.  Strings and containers are
+    /// constructed with the given allocator wherever it converts to theirs,
+    /// such as a std::pmr::polymorphic_allocator of any type
+    if constexpr(is_std_string<T>::value) {
+      return read_varstring<T>(length_max, convert_allocator<typename T::allocator_type>(allocator));
+    } else if constexpr(is_std_vector<T>::value) {
+      return read_vector<typename T::value_type, typename T::allocator_type>(length_max, convert_allocator<typename T::allocator_type>(allocator));
+    } else if constexpr(is_std_array<T>::value) {
+      return read_array<typename T::value_type, std::tuple_size_v<T>>(length_max, allocator);
+    } else if constexpr(is_map_like<T>::value) {
+      return read_map<T>(length_max, convert_allocator<typename T::allocator_type>(allocator));
+    } else if constexpr(is_std_optional<T>::value) {
+      return read_optional<typename T::value_type>(length_max, allocator);
+    } else if constexpr(is_std_variant<T>::value) {
+      return read_variant<T>(length_max, allocator);
+    } else if constexpr(is_std_tuple<T>::value) {
+      return read_tuple<T>(length_max, allocator);
+    } else {
+      static_assert(is_pod_value<T>, "SerialStorm: type cannot be read generically - it is not a supported container and is not trivially copyable");
+      return read_pod<T>();
+    }
+  }
+
+  template<typename T, typename Allocator = std::allocator<T>>
+  inline std::vector<T, Allocator> read_vector(size_t const length_max = 0,
+                                               Allocator const &allocator = {}) const {
+    /// Read a vector prefixed with its varint length, optionally limiting the
+    /// number of elements to prevent overflow or DOS attacks.  Trivially
+    /// copyable elements are read in a single read from the stream
+    size_t const length(read_varint<size_t>());
+    if(length_max != 0 && length > length_max) {                                // optionally limit the element count to a safe maximum
+      std::stringstream ss;
+      ss << "SerialStorm: Vector length " << length << " exceeded the permitted maximum of " << length_max;
+      REPORT_ERROR
+    }
+    check_element_count<T>(length);
+    std::vector<T, Allocator> vector(allocator);
+    if constexpr(is_pod_value<T> && !std::is_same_v<T, bool>) {                 // std::vector<bool> is not contiguous
+      vector.resize(length);
+      read_pod_array(vector.data(), length);
+    } else {
+      vector.reserve(length);
+      for(size_t i = 0; i != length; ++i) {
+        vector.emplace_back(read_value<T>(length_max, allocator));
+      }
+    }
+    return vector;
+  }
+
+  template<typename T, size_t N, typename Allocator = std::allocator<char>>
+  inline std::array<T, N> read_array([[maybe_unused]] size_t const length_max = 0,
+                                     [[maybe_unused]] Allocator const &allocator = {}) const {
+    /// Read a fixed size array; no length is sent, as it is known in advance
+    std::array<T, N> array;
+    if constexpr(is_pod_value<T>) {
+      read_pod_array(array.data(), N);
+    } else {
+      for(auto &element : array) {
+        element = read_value<T>(length_max, allocator);
+      }
+    }
+    return array;
+  }
+
+  template<typename Map>
+  inline Map read_map(size_t const length_max = 0,
+                      typename Map::allocator_type const &allocator = {}) const {
+    /// Read a map (or anything with the same interface, such as an
+    /// unordered_map) prefixed with its varint length, optionally limiting the
+    /// number of elements to prevent overflow or DOS attacks
+    static_assert(is_map_like<Map>::value, "SerialStorm: read_map requires a type with key_type and mapped_type");
+    size_t const length(read_varint<size_t>());
+    if(length_max != 0 && length > length_max) {                                // optionally limit the element count to a safe maximum
+      std::stringstream ss;
+      ss << "SerialStorm: Map length " << length << " exceeded the permitted maximum of " << length_max;
+      REPORT_ERROR
+    }
+    check_element_count<typename Map::value_type>(length);
+    Map map(allocator);
+    if constexpr(has_reserve<Map>::value) {
+      map.reserve(length);
+    }
+    for(size_t i = 0; i != length; ++i) {
+      auto key(read_value<typename Map::key_type>(length_max, allocator));
+      map.emplace_hint(map.end(), std::move(key), read_value<typename Map::mapped_type>(length_max, allocator)); // ordered maps arrive sorted, so hinting the end makes insertion constant time
+    }
+    return map;
+  }
+
+  template<typename T, typename Allocator = std::allocator<char>>
+  inline std::optional<T> read_optional(size_t const length_max = 0,
+                                        Allocator const &allocator = {}) const {
+    /// Read an optional value, prefixed with a byte to say whether it is present
+    if(read_pod<uint8_t>() == 0) {
+      return std::nullopt;
+    }
+    return read_value<T>(length_max, allocator);
+  }
+
+  template<typename Variant, typename Allocator = std::allocator<char>>
+  inline Variant read_variant(size_t const length_max = 0,
+                              Allocator const &allocator = {}) const {
+    /// Read a variant, prefixed with the varint index of the alternative it holds
+    size_t const index(read_varint<size_t>());
+    if(index >= std::variant_size_v<Variant>) {
+      std::stringstream ss;
+      ss << "SerialStorm: Variant index " << index << " is not in the protocol";
+      REPORT_ERROR
+    }
+    return read_variant_alternative<Variant, Allocator>(index, length_max, allocator, std::make_index_sequence<std::variant_size_v<Variant>>{});
+  }
+
+  template<typename Tuple, typename Allocator = std::allocator<char>>
+  inline Tuple read_tuple(size_t const length_max = 0,
+                          Allocator const &allocator = {}) const {
+    /// Read each element of a tuple or pair in turn
+    return read_tuple_elements<Tuple>(length_max, allocator, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+  }
+
+  // --------------------- Non-throwing reading functions ----------------------
+  // These report malformed input and short reads by returning an errc rather
+  // than throwing, and do no allocation or formatting on the error path.
+  // After an error the stream should be considered out of sync.
+  template<typename T>
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// CRTP polymorphic buffer read function, reporting errors instead of throwing
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
+      if(errc const error = try_check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "B>"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    if(!within_read_budget(size)) {
+      return errc::BUDGET_EXCEEDED;
+    }
+    if(errc const error = static_cast<StreamT<StreamParam> const*>(this)->try_read_buffer(data, size); error != errc::NONE) {
+      return error;
+    }
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
+      if(errc const error = try_check_verification("<B"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
+    return errc::NONE;
+  }
+
+  template<typename T>
+  inline result<T> try_read_pod() const {
+    /// Read a plain old data value from the stream, reporting errors instead of throwing
+    result<T> data(try_read_pod_unmetered<T>());
+    if(data) {
+      count_read(&stream_stats::direction::pod, sizeof(T));
+    }
+    return data;
+  }
+
+  template<typename T>
+  inline result<T> try_read_varint() const {
+    /// Read a variable-size unsigned integer from the stream, reporting errors instead of throwing
+    switch(varint_codec_used) {
+    case varint_codec::LEB128:
+      return try_read_varint_codec<T>(&stream_base::try_read_varint_leb128);
+    case varint_codec::PREFIX:
+      return try_read_varint_codec<T>(&stream_base::try_read_varint_prefix);
+    case varint_codec::TAGGED:
+      break;
+    }
+    result<uint8_t> const datasize(try_read_pod_unmetered<uint8_t>());
+    if(!datasize) {
+      return datasize.error();
+    }
+    if(!(*datasize & static_cast<uint8_t>(varint_size::UINT_8))) {             // this isn't a data size, the first byte is the value itself
+      count_read_varint(1);
+      return cast_if_required<T>(*datasize);
+    }
+    #pragma GCC diagnostic push
+    #ifdef __clang__
+      #pragma GCC diagnostic ignored "-Wcovered-switch-default"
+    #endif // __clang__
+    switch(static_cast<varint_size>(*datasize)) {
+    case varint_size::UINT_8:
+      return try_read_varint_body<T, uint8_t>();
+    case varint_size::UINT_16:
+      return try_read_varint_body<T, uint16_t>();
+    case varint_size::UINT_32:
+      return try_read_varint_body<T, uint32_t>();
+    case varint_size::UINT_64:
+      return try_read_varint_body<T, uint64_t>();
+    default:                                                                    // unknown type, protocol error
+      return errc::BAD_VARINT_SIZE;
+    }
+    #pragma GCC diagnostic pop
+  }
+
+  template<typename T>
+  result<std::string> try_read_string(T const stringlength) const {
+    /// Fill a string of the specified size from the stream, reporting errors instead of throwing
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_STRING, static_cast<size_t>(stringlength));
+    #endif // SERIALSTORM_TRACE
+    #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
+      if(errc const error = try_check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "S>"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_STRING
+    if(!within_read_budget(static_cast<size_t>(stringlength)) || !within_allocation_max(static_cast<size_t>(stringlength))) { // before allocating, so a hostile length can't exhaust memory
+      return errc::BUDGET_EXCEEDED;
+    }
+    errc read_error{errc::NONE};
+    std::string string(make_string_for_overwrite<std::string>(stringlength, {}, [&](char *data, size_t const size){
+      read_error = static_cast<StreamT<StreamParam> const*>(this)->try_read_buffer(data, size);
+      return read_error == errc::NONE;
+    }));
+    if(read_error != errc::NONE) {
+      return read_error;
+    }
+    #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
+      if(errc const error = try_check_verification("<S"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_STRING
+    read_pos += string.size();
+    count_read(&stream_stats::direction::backend, string.size());
+    count_read(&stream_stats::direction::string, string.size());
+    return string;
+  }
+
+  template<typename T>
+  inline result<std::string> try_read_varstring_fixed(size_t const length_max = 0) const {
+    /// Read a varstring with a fixed size length type from the stream, reporting errors instead of throwing
+    result<T> const stringlength(try_read_pod<T>());
+    if(!stringlength) {
+      return stringlength.error();
+    }
+    if(length_max != 0 && *stringlength > length_max) {                         // optionally limit the info length to a safe maximum
+      return errc::LENGTH_EXCEEDED;
+    }
+    return try_read_string(*stringlength);
+  }
+
+  inline result<std::string> try_read_varstring(size_t const length_max = 0) const {
+    /// Read a varstring from the stream, reporting errors instead of throwing
+    result<size_t> const stringlength(try_read_varint<size_t>());
+    if(!stringlength) {
+      return stringlength.error();
+    }
+    if(length_max != 0 && *stringlength > length_max) {                         // optionally limit the info length to a safe maximum
+      return errc::LENGTH_EXCEEDED;
+    }
+    return try_read_string(*stringlength);
+  }
+
+  inline errc try_read_varblob(std::ostream &outstream,
+                               size_t const length_max = 0,
+                               size_t const buffer_max_size = 1024 * 1024) const { // maximum buffer size until write out to stream, tuneable
+    /// Read a sequence of binary data of arbitrary length to a stream, reporting errors instead of throwing
+    result<size_t> const datalength(try_read_varint<size_t>());
+    if(!datalength) {
+      return datalength.error();
+    }
+    if(length_max != 0 && *datalength > length_max) {                           // optionally limit the info length to a safe maximum
+      return errc::LENGTH_EXCEEDED;
+    }
+    return try_read_blob(outstream, *datalength, buffer_max_size);
+  }
+  inline errc try_read_blob(std::ostream &outstream,
+                            size_t datalength,
+                            size_t const buffer_max_size = 1024 * 1024) const { // maximum buffer size until write out to stream, tuneable
+    /// Read a sequence of binary data of known length to a stream, reporting errors instead of throwing
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
+      if(errc const error = try_check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "L>"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+    if(!within_read_budget(datalength)) {                                       // fail before reading any of it, rather than part way through
+      return errc::BUDGET_EXCEEDED;
+    }
+    count_read(&stream_stats::direction::blob, datalength);
+    std::vector<char, default_init_allocator<char>> buffer(std::min(datalength, buffer_max_size)); // size the buffer to the data length or max size, uninitialised as it is about to be overwritten
+    for(; datalength != 0; datalength -= buffer.size()) {                       // if it takes more than one buffer fill to read the data, repeat
+      buffer.resize(std::min(datalength, buffer_max_size));                     // shrink the buffer if there's not enough data left to fill it
+      if(errc const error = try_read_buffer(buffer.data(), buffer.size()); error != errc::NONE) {
+        return error;
+      }
+      outstream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
+      if(errc const error = try_check_verification("<L"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+    return errc::NONE;
+  }
+
   // ------------------------- Writing functions -------------------------------
   template<typename T>
   inline void write_buffer(T const &buffer) {
     /// CRTP polymorphic buffer write function passing whatever native buffer the stream takes
     /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BUFFER, StreamT<StreamParam>::buffer_size(buffer));
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "B>");
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
@@ -200,11 +704,17 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       write_verification("<B");
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    size_t const size(StreamT<StreamParam>::buffer_size(buffer));
+    write_pos += size;
+    count_write(&stream_stats::direction::backend, size);
   }
   template<typename T>
   inline void write_buffer(T const *data, size_t const size) {
     /// CRTP polymorphic buffer write function
     /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "B>");
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
@@ -212,46 +722,96 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
       write_verification("<B");
     #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    write_pos += size;
+    count_write(&stream_stats::direction::backend, size);
+  }
+
+  template<typename Buffers>
+  inline void write_gather(Buffers const &buffers) {
+    /// CRTP polymorphic gather write function, writing a sequence of
+    /// contiguous byte buffers (anything with data() and size()) as if they
+    /// were one, in a single call to the stream where the stream supports it
+    /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    size_t size{0};
+    for(auto const &buffer : buffers) {
+      size += buffer.size();
+    }
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
+      write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "B>");
+    #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    static_cast<StreamT<StreamParam>*>(this)->write_buffers(buffers);           // named differently in backends, so this can never be hidden by them
+    #ifdef SERIALSTORM_DEBUG_VERIFY_BUFFER
+      write_verification("<B");
+    #endif // SERIALSTORM_DEBUG_VERIFY_BUFFER
+    write_pos += size;
+    count_write(&stream_stats::direction::backend, size);
   }
 
   template<typename T>
   inline void write_pod(T const &data) {
     /// Write a plain old data entity to the stream
+    count_write(&stream_stats::direction::pod, sizeof(data));
+    write_pod_unmetered(data);
+  }
+
+  template<typename T>
+  inline void write_pod_array(T const *data, size_t const count) {
+    /// Write an array of plain old data values to the stream in one go,
+    /// converting the byte order in blocks if required
     #ifdef SERIALSTORM_DEBUG_VERIFY_POD
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "P>");
     #endif // SERIALSTORM_DEBUG_VERIFY_POD
-    write_buffer(&data, sizeof(data));
+    if constexpr(needs_byte_swap<T>) {
+      constexpr size_t block_size{4096 / sizeof(T)};                            // swap through a small stack buffer rather than allocating
+      T block[block_size];
+      for(size_t done = 0; done != count;) {
+        size_t const block_count(std::min(count - done, block_size));
+        byte_swap_array(data + done, block, block_count);
+        write_buffer(block, block_count * sizeof(T));
+        done += block_count;
+      }
+    } else {
+      write_buffer(data, count * sizeof(T));
+    }
     #ifdef SERIALSTORM_DEBUG_VERIFY_POD
       write_verification("<P");
     #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    count_write(&stream_stats::direction::pod, count * sizeof(T));
   }
 
   template<typename T, class = typename std::enable_if<std::is_unsigned<T>::value>::type>
   inline void write_varint(T const uint) {
-    /// Write a variable-length unsigned integer to the stream
-    ///   Designed to work with uints only.  If our int is smaller than 128, we
-    ///   simply write it as-is, sign bit unset.  Otherwise we flip the sign bit
-    ///   on the first byte, and set the value to log2 of the number of bytes.
-    if(uint < static_cast<uint8_t>(varint_size::UINT_8)) {                      // uint8_t half-byte (128), sent on its own
-      write_pod(static_cast<uint8_t>(uint));
-    } else if(uint <= std::numeric_limits<uint8_t>::max()) {                    // fits in a uint8_t (256 aka 0b1'00000000 or 0x1'00)
-      write_pod(varint_size::UINT_8);                                           // 1 byte
-      write_pod(static_cast<uint8_t>(uint));
-    } else if(uint <= std::numeric_limits<uint16_t>::max()) {                   // fits in a uint16_t (65536 aka 0b1'00000000'00000000 or 0x1'00'00)
-      write_pod(varint_size::UINT_16);                                          // 2 bytes
-      write_pod(static_cast<uint16_t>(uint));
-    } else if(uint <= std::numeric_limits<uint32_t>::max()) {                   // fits in a uint32_t (4294967296 aka 0b1'00000000'00000000'00000000'00000000 or 0x1'00'00'00'00)
-      write_pod(varint_size::UINT_32);                                          // 4 bytes
-      write_pod(static_cast<uint32_t>(uint));
-    } else {                                                                    // assume uint64_t (18446744073709551616 aka 0x1'0000'0000'0000'0000) max size
-      write_pod(varint_size::UINT_64);                                          // 8 bytes
-      write_pod(static_cast<uint64_t>(uint));
+    /// Write a variable-length unsigned integer to the stream, in the format
+    /// chosen with set_varint_codec
+    uint8_t bytes[varint_size_max];
+    switch(varint_codec_used) {
+    case varint_codec::LEB128:
+      write_varint_bytes(bytes, encode_varint_leb128(uint, bytes));
+      return;
+    case varint_codec::PREFIX:
+      write_varint_bytes(bytes, encode_varint_prefix(uint, bytes));
+      return;
+    case varint_codec::TAGGED:
+      break;
     }
+    write_varint_tagged(uint);
   }
 
   inline void write_string(std::string const &string) {
-    /// CRTP polymorphic buffer write function: write a bare string to the stream
+    /// Write a bare std::string, or anything which converts to one such as a string literal, to the stream
     /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    write_string<std::char_traits<char>, std::allocator<char>>(string);
+  }
+  template<typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<char, Traits, Allocator> const &string) {
+    /// CRTP polymorphic buffer write function: write a bare string with any allocator, such as a std::pmr::string, to the stream
+    /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_STRING, string.size());
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "S>");
     #endif // SERIALSTORM_DEBUG_VERIFY_STRING
@@ -259,6 +819,9 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_STRING
       write_verification("<S");
     #endif // SERIALSTORM_DEBUG_VERIFY_STRING
+    write_pos += string.size();
+    count_write(&stream_stats::direction::backend, string.size());
+    count_write(&stream_stats::direction::string, string.size());
   }
 
   template<typename T>
@@ -273,11 +836,31 @@ public:
     write_varint(string.length());
     write_string(string);
   }
+  template<typename Traits, typename Allocator>
+  inline void write_varstring(std::basic_string<char, Traits, Allocator> const &string) {
+    /// Write a string of arbitrary length with any allocator, such as a std::pmr::string, to the stream
+    write_varint(string.length());
+    write_string(string);
+  }
+
+  inline void write_varstring_interned(std::string const &string,
+                                       string_dictionary_writer &dictionary) {
+    /// Write a string via a dictionary: the first time a string is sent it is
+    /// written in full with a new id, and after that only its id is written
+    auto const [id, is_new] = dictionary.intern(string);
+    write_varint(id);
+    if(is_new) {
+      write_varstring(string);
+    }
+  }
 
   template<typename T>
   inline void write_blob(std::vector<T> const &blob) {
     /// CTCP polymorphic buffer write function: write a bare blob to the stream
     /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BLOB, blob.size() * sizeof(T));
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "L>");
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
@@ -285,11 +868,17 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
       write_verification("<L");
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+    write_pos += blob.size() * sizeof(T);
+    count_write(&stream_stats::direction::backend, blob.size() * sizeof(T));
+    count_write(&stream_stats::direction::blob, blob.size() * sizeof(T));
   }
   template<typename T>
   inline void write_blob(std::vector<T> const &blob, size_t const size) {
     /// CTCP polymorphic buffer write function: write a bare blob to the stream
     /// Note: this cannot be safely decoded on its own unless its length is known by the recipient
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BLOB, size);
+    #endif // SERIALSTORM_TRACE
     #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
       write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "L>");
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
@@ -297,6 +886,9 @@ public:
     #ifdef SERIALSTORM_DEBUG_VERIFY_BLOB
       write_verification("<L");
     #endif // SERIALSTORM_DEBUG_VERIFY_BLOB
+    write_pos += size;
+    count_write(&stream_stats::direction::backend, size);
+    count_write(&stream_stats::direction::blob, size);
   }
 
   inline void write_varblob(std::vector<char> const &blob) {
@@ -310,7 +902,8 @@ public:
     /// Write a sequence of binary data of arbitrary length from an istream to
     /// the stream, buffering and sending chunks at a time
     write_varint(datalength);
-    std::vector<char> buffer(std::min(datalength, buffer_max_size));            // size the buffer to the data length or max size, as appropriate
+    count_write(&stream_stats::direction::blob, datalength);
+    std::vector<char, default_init_allocator<char>> buffer(std::min(datalength, buffer_max_size)); // size the buffer to the data length or max size, uninitialised as it is about to be overwritten
     for(;;) {
       std::streamsize readbytes = instream.readsome(buffer.data(), static_cast<std::streamsize>(buffer.size())); // more efficient than just forcing it to fill the buffer
       write_buffer(buffer.data(), readbytes);
@@ -322,7 +915,444 @@ public:
     }
   }
 
+  // ------------------- Container writing functions --------------------------
+  template<typename T>
+  inline void write_value(T const &value) {
+    /// Write a value of any supported type to the stream, choosing the
+    /// encoding by type to match read_value
+    if constexpr(is_std_string<T>::value) {
+      static_assert(std::is_same_v<typename T::value_type, char>, "SerialStorm: strings can only be written from a std::basic_string of char");
+      write_varstring(value);
+    } else if constexpr(is_std_vector<T>::value) {
+      write_vector(value);
+    } else if constexpr(is_std_array<T>::value) {
+      write_array(value);
+    } else if constexpr(is_map_like<T>::value) {
+      write_map(value);
+    } else if constexpr(is_std_optional<T>::value) {
+      write_optional(value);
+    } else if constexpr(is_std_variant<T>::value) {
+      write_variant(value);
+    } else if constexpr(is_std_tuple<T>::value) {
+      write_tuple(value);
+    } else {
+      static_assert(is_pod_value<T>, "SerialStorm: type cannot be written generically - it is not a supported container and is not trivially copyable");
+      write_pod(value);
+    }
+  }
+
+  template<typename T, typename Allocator>
+  inline void write_vector(std::vector<T, Allocator> const &vector) {
+    /// Write a vector prefixed with its varint length.  Trivially copyable
+    /// elements are written in a single write to the stream
+    write_varint(vector.size());
+    if constexpr(is_pod_value<T> && !std::is_same_v<T, bool>) {                 // std::vector<bool> is not contiguous
+      write_pod_array(vector.data(), vector.size());
+    } else {
+      for(auto const &element : vector) {
+        write_value(element);
+      }
+    }
+  }
+
+  template<typename T, size_t N>
+  inline void write_array(std::array<T, N> const &array) {
+    /// Write a fixed size array; no length is sent, as it is known in advance
+    if constexpr(is_pod_value<T>) {
+      write_pod_array(array.data(), N);
+    } else {
+      for(auto const &element : array) {
+        write_value(element);
+      }
+    }
+  }
+
+  template<typename Map>
+  inline void write_map(Map const &map) {
+    /// Write a map (or anything with the same interface, such as an
+    /// unordered_map) prefixed with its varint length
+    static_assert(is_map_like<Map>::value, "SerialStorm: write_map requires a type with key_type and mapped_type");
+    write_varint(map.size());
+    for(auto const &[key, value] : map) {
+      write_value(key);
+      write_value(value);
+    }
+  }
+
+  template<typename T>
+  inline void write_optional(std::optional<T> const &optional) {
+    /// Write an optional value, prefixed with a byte to say whether it is present
+    write_pod(static_cast<uint8_t>(optional.has_value()));
+    if(optional) {
+      write_value(*optional);
+    }
+  }
+
+  template<typename... Ts>
+  inline void write_variant(std::variant<Ts...> const &variant) {
+    /// Write a variant, prefixed with the varint index of the alternative it holds
+    write_varint(variant.index());
+    std::visit([this](auto const &alternative){
+      write_value(alternative);
+    }, variant);
+  }
+
+  template<typename Tuple>
+  inline void write_tuple(Tuple const &tuple) {
+    /// Write each element of a tuple or pair in turn
+    std::apply([this](auto const &... elements){
+      (write_value(elements), ...);
+    }, tuple);
+  }
+
+protected:
+  inline void count_partial_read(size_t const size) const {
+    /// For backends: count the part of a read which failed after consuming
+    /// data that can't be handed back to the stream, such as a blob already
+    /// written to a file descriptor, so tellp() still matches what was read
+    read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
+  }
+
 private:
+  template<typename Variant, typename Allocator, size_t I>
+  inline Variant read_variant_alternative_at(size_t const length_max, Allocator const &allocator) const {
+    /// Read the alternative of a variant with the given index
+    return Variant(std::in_place_index<I>, read_value<std::variant_alternative_t<I, Variant>>(length_max, allocator));
+  }
+  template<typename Variant, typename Allocator, size_t... Is>
+  inline Variant read_variant_alternative(size_t const index, size_t const length_max, Allocator const &allocator, std::index_sequence<Is...>) const {
+    /// Read the alternative of a variant with the given index through a jump table
+    using reader = Variant (stream_base::*)(size_t, Allocator const&) const;
+    static constexpr reader readers[]{&stream_base::read_variant_alternative_at<Variant, Allocator, Is>...};
+    return (this->*readers[index])(length_max, allocator);
+  }
+
+  template<typename Tuple, typename Allocator, size_t... Is>
+  inline Tuple read_tuple_elements([[maybe_unused]] size_t const length_max, [[maybe_unused]] Allocator const &allocator, std::index_sequence<Is...>) const {
+    /// Read each element of a tuple in order - braced initialisation guarantees left to right evaluation
+    return Tuple{read_value<std::tuple_element_t<Is, Tuple>>(length_max, allocator)...};
+  }
+
+  template<typename T>
+  inline T read_pod_unmetered() const {
+    /// Read a plain old data value from the stream without counting it as a pod in the stats
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "P>", __func__);
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    T data;
+    read_buffer(&data);
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      check_verification("<P", __func__);
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    if constexpr(needs_byte_swap<T>) {
+      return byte_swap(data);
+    } else {
+      return data;
+    }
+  }
+
+  template<typename T>
+  inline result<T> try_read_pod_unmetered() const {
+    /// Read a plain old data value from the stream without counting it as a pod in the stats, reporting errors instead of throwing
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      if(errc const error = try_check_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "P>"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    T data;
+    if(errc const error = try_read_buffer(&data, sizeof(data)); error != errc::NONE) {
+      return error;
+    }
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      if(errc const error = try_check_verification("<P"); error != errc::NONE) {
+        return error;
+      }
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    if constexpr(needs_byte_swap<T>) {
+      return byte_swap(data);
+    } else {
+      return data;
+    }
+  }
+
+  template<typename T>
+  inline T read_varint_tagged() const {
+    /// Read a variable-size unsigned integer in the tagged format from the stream
+    ///   Designed to work with uints only.  If our first byte is smaller than
+    ///   128, we simply read it as-is.  Otherwise we flip the sign bit on the
+    ///   first byte to get x, and read 2^x bytes as the uint, and try to fit it
+    ///   into the supplied template type (which may overflow).
+    uint8_t datasize(read_pod_unmetered<uint8_t>());
+    if(datasize & static_cast<uint8_t>(varint_size::UINT_8)) {                  // uint8_t half-byte (128), sent on its own
+      switch(static_cast<varint_size>(datasize)) {
+      case varint_size::UINT_8:                                                 // read a uint8_t  (1 byte)
+        count_read_varint(1 + sizeof(uint8_t));
+        return cast_if_required<T>(read_pod_unmetered<uint8_t>());
+      case varint_size::UINT_16:                                                // read a uint16_t (2 bytes)
+        count_read_varint(1 + sizeof(uint16_t));
+        return cast_if_required<T>(read_pod_unmetered<uint16_t>());
+      case varint_size::UINT_32:                                                // read a uint32_t (4 bytes)
+        count_read_varint(1 + sizeof(uint32_t));
+        return cast_if_required<T>(read_pod_unmetered<uint32_t>());
+      case varint_size::UINT_64:                                                // read a uint64_t (8 bytes)
+        count_read_varint(1 + sizeof(uint64_t));
+        return cast_if_required<T>(read_pod_unmetered<uint64_t>());
+      #pragma GCC diagnostic push
+      #ifdef __clang__
+        #pragma GCC diagnostic ignored "-Wcovered-switch-default"
+      #endif // __clang__
+      default:                                                                  // unknown type, protocol error
+        std::stringstream ss;
+        ss << "SerialStorm: Varint size " << static_cast<uint64_t>(datasize) << " is not in the protocol";
+        REPORT_ERROR
+      #pragma GCC diagnostic push
+      }
+    } else {                                                                    // this isn't a data size, this is a nibble (half-byte) containing the value itself
+      count_read_varint(1);
+      return datasize;                                                          // the first byte is the value itself
+    }
+  }
+
+  template<typename T, class = typename std::enable_if<std::is_unsigned<T>::value>::type>
+  inline void write_varint_tagged(T const uint) {
+    /// Write a variable-length unsigned integer in the tagged format to the stream
+    ///   Designed to work with uints only.  If our int is smaller than 128, we
+    ///   simply write it as-is, sign bit unset.  Otherwise we flip the sign bit
+    ///   on the first byte, and set the value to log2 of the number of bytes.
+    if(uint < static_cast<uint8_t>(varint_size::UINT_8)) {                      // uint8_t half-byte (128), sent on its own
+      count_write_varint(1);
+      write_pod_unmetered(static_cast<uint8_t>(uint));
+    } else if(uint <= std::numeric_limits<uint8_t>::max()) {                    // fits in a uint8_t (256 aka 0b1'00000000 or 0x1'00)
+      count_write_varint(1 + sizeof(uint8_t));
+      write_pod_unmetered(varint_size::UINT_8);                                 // 1 byte
+      write_pod_unmetered(static_cast<uint8_t>(uint));
+    } else if(uint <= std::numeric_limits<uint16_t>::max()) {                   // fits in a uint16_t (65536 aka 0b1'00000000'00000000 or 0x1'00'00)
+      count_write_varint(1 + sizeof(uint16_t));
+      write_pod_unmetered(varint_size::UINT_16);                                // 2 bytes
+      write_pod_unmetered(static_cast<uint16_t>(uint));
+    } else if(uint <= std::numeric_limits<uint32_t>::max()) {                   // fits in a uint32_t (4294967296 aka 0b1'00000000'00000000'00000000'00000000 or 0x1'00'00'00'00)
+      count_write_varint(1 + sizeof(uint32_t));
+      write_pod_unmetered(varint_size::UINT_32);                                // 4 bytes
+      write_pod_unmetered(static_cast<uint32_t>(uint));
+    } else {                                                                    // assume uint64_t (18446744073709551616 aka 0x1'0000'0000'0000'0000) max size
+      count_write_varint(1 + sizeof(uint64_t));
+      write_pod_unmetered(varint_size::UINT_64);                                // 8 bytes
+      write_pod_unmetered(static_cast<uint64_t>(uint));
+    }
+  }
+
+  inline uint64_t read_varint_leb128() const {
+    /// Read a LEB128 varint from the stream a byte at a time
+    uint64_t value{0};
+    for(size_t i = 0;; ++i) {
+      uint8_t byte;
+      read_varint_bytes(&byte, 1);
+      if(i == varint_size_max - 1 && byte > 1) {                                // the tenth byte may only hold the 64th bit
+        std::stringstream ss;
+        ss << "SerialStorm: LEB128 varint exceeds 64 bits";
+        REPORT_ERROR
+      }
+      value |= static_cast<uint64_t>(byte & 0x7Fu) << (7 * i);
+      if(!(byte & 0x80u)) {
+        count_read_varint(i + 1);
+        return value;
+      }
+    }
+  }
+
+  inline uint64_t read_varint_prefix() const {
+    /// Read a prefix varint from the stream: the first byte gives the size,
+    /// and the rest is decoded without branching on the value
+    uint8_t bytes[sizeof(uint64_t) + 1]{};
+    read_varint_bytes(bytes, 1);
+    size_t const size(varint_prefix_size_from_first(bytes[0]));
+    if(size != 1) {
+      read_varint_bytes(bytes + 1, size - 1);
+    }
+    count_read_varint(size);
+    return decode_varint_prefix(bytes[0], varint_prefix_rest(bytes + 1), size);
+  }
+
+  inline result<uint64_t> try_read_varint_leb128() const {
+    /// Read a LEB128 varint from the stream a byte at a time, reporting errors instead of throwing
+    uint64_t value{0};
+    for(size_t i = 0;; ++i) {
+      uint8_t byte;
+      if(errc const error = try_read_varint_bytes(&byte, 1); error != errc::NONE) {
+        return error;
+      }
+      if(i == varint_size_max - 1 && byte > 1) {
+        return errc::BAD_VARINT_SIZE;
+      }
+      value |= static_cast<uint64_t>(byte & 0x7Fu) << (7 * i);
+      if(!(byte & 0x80u)) {
+        count_read_varint(i + 1);
+        return value;
+      }
+    }
+  }
+
+  inline result<uint64_t> try_read_varint_prefix() const {
+    /// Read a prefix varint from the stream, reporting errors instead of throwing
+    uint8_t bytes[sizeof(uint64_t) + 1]{};
+    if(errc const error = try_read_varint_bytes(bytes, 1); error != errc::NONE) {
+      return error;
+    }
+    size_t const size(varint_prefix_size_from_first(bytes[0]));
+    if(size != 1) {
+      if(errc const error = try_read_varint_bytes(bytes + 1, size - 1); error != errc::NONE) {
+        return error;
+      }
+    }
+    count_read_varint(size);
+    return decode_varint_prefix(bytes[0], varint_prefix_rest(bytes + 1), size);
+  }
+
+  template<typename T>
+  inline result<T> try_read_varint_codec(result<uint64_t> (stream_base::*reader)() const) const {
+    /// Read a varint with one of the byte-oriented codecs and fit it into the requested type
+    result<uint64_t> const value((this->*reader)());
+    if(!value) {
+      return value.error();
+    }
+    return cast_if_required<T>(*value);
+  }
+
+  inline bool within_read_budget(size_t const size) const {
+    /// Report whether size more bytes can be read within the read budget; a
+    /// single compare, as read_pos never passes the end of the budget
+    return size <= read_budget_end - read_pos;
+  }
+  inline bool within_allocation_max(size_t const count, size_t const element_size = 1) const {
+    /// Report whether count elements of element_size bytes fit within the allocation limit
+    return allocation_max == 0 || count <= allocation_max / element_size;       // divide rather than multiply, so a hostile count can't overflow
+  }
+
+  template<typename T>
+  inline void check_element_count(size_t const count) const {
+    /// Check a decoded container's element count against the read budget and
+    /// the allocation limit before anything is allocated for it
+    constexpr size_t element_wire_size_min(is_pod_value<T> ? sizeof(T) : has_nonempty_encoding<T>::value ? 1 : 0);
+    if constexpr(element_wire_size_min != 0) {
+      if(count > read_budget_remaining() / element_wire_size_min) {
+        std::stringstream ss;
+        ss << "SerialStorm: Container of " << count << " elements exceeded the remaining decode budget of " << read_budget_remaining() << " bytes";
+        REPORT_ERROR_NORETURN
+      }
+    }
+    check_allocation(count, sizeof(T));
+  }
+
+  static inline uint64_t varint_prefix_rest(uint8_t const *bytes) {
+    /// Assemble the eight bytes following a prefix varint's first byte as a little-endian integer
+    uint64_t rest;
+    std::memcpy(&rest, bytes, sizeof(rest));
+    if constexpr(byte_order::NATIVE == byte_order::BIG) {
+      rest = byte_swap(rest);
+    }
+    return rest;
+  }
+
+  inline void read_varint_bytes(uint8_t *data, size_t const size) const {
+    /// Read the bytes of a byte-oriented varint straight from the backend.
+    /// These are never wrapped in debug verification markers, so reads and
+    /// writes stay in step however they are split into backend calls
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    check_read_budget(size);
+    static_cast<StreamT<StreamParam> const*>(this)->read_buffer(data, size);
+    read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
+  }
+  inline errc try_read_varint_bytes(uint8_t *data, size_t const size) const {
+    /// Read the bytes of a byte-oriented varint straight from the backend, reporting errors instead of throwing
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::READ_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    if(!within_read_budget(size)) {
+      return errc::BUDGET_EXCEEDED;
+    }
+    if(errc const error = static_cast<StreamT<StreamParam> const*>(this)->try_read_buffer(data, size); error != errc::NONE) {
+      return error;
+    }
+    read_pos += size;
+    count_read(&stream_stats::direction::backend, size);
+    return errc::NONE;
+  }
+  inline void write_varint_bytes(uint8_t const *data, size_t const size) {
+    /// Write an encoded byte-oriented varint straight to the backend in one call
+    #ifdef SERIALSTORM_TRACE
+      trace_scope<SERIALSTORM_TRACE> const trace(trace_op::WRITE_BUFFER, size);
+    #endif // SERIALSTORM_TRACE
+    count_write_varint(size);
+    static_cast<StreamT<StreamParam>*>(this)->write_buffer(data, size);
+    write_pos += size;
+    count_write(&stream_stats::direction::backend, size);
+  }
+
+  template<typename T, typename BodyT>
+  inline result<T> try_read_varint_body() const {
+    /// Read the body of a varint once its size is known, reporting errors instead of throwing
+    result<BodyT> const body(try_read_pod_unmetered<BodyT>());
+    if(!body) {
+      return body.error();
+    }
+    count_read_varint(1 + sizeof(BodyT));
+    return cast_if_required<T>(*body);
+  }
+
+  template<typename T>
+  inline void write_pod_unmetered(T const &data) {
+    /// Write a plain old data entity to the stream without counting it as a pod in the stats
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      write_verification(SERIALSTORM_DEBUG_VERIFY_DELIMITER + "P>");
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+    if constexpr(needs_byte_swap<T>) {
+      T const swapped(byte_swap(data));
+      write_buffer(&swapped, sizeof(swapped));
+    } else {
+      write_buffer(&data, sizeof(data));
+    }
+    #ifdef SERIALSTORM_DEBUG_VERIFY_POD
+      write_verification("<P");
+    #endif // SERIALSTORM_DEBUG_VERIFY_POD
+  }
+
+  // --------------------- Instrumentation functions ---------------------------
+  // These compile to nothing unless SERIALSTORM_STATS is defined
+  inline void count_read([[maybe_unused]] stream_stats::counter stream_stats::direction::*counter,
+                         [[maybe_unused]] size_t const bytes) const {
+    /// Record a read operation of the given type and size
+    #ifdef SERIALSTORM_STATS
+      ++(stats_data.read.*counter).calls;
+      (stats_data.read.*counter).bytes += bytes;
+    #endif // SERIALSTORM_STATS
+  }
+  inline void count_write([[maybe_unused]] stream_stats::counter stream_stats::direction::*counter,
+                          [[maybe_unused]] size_t const bytes) {
+    /// Record a write operation of the given type and size
+    #ifdef SERIALSTORM_STATS
+      ++(stats_data.write.*counter).calls;
+      (stats_data.write.*counter).bytes += bytes;
+    #endif // SERIALSTORM_STATS
+  }
+  inline void count_read_varint([[maybe_unused]] size_t const bytes) const {
+    /// Record a varint read of the given encoded size, including its size band
+    #ifdef SERIALSTORM_STATS
+      count_read(&stream_stats::direction::varint, bytes);
+      ++stats_data.read.varint_sizes[bytes];
+    #endif // SERIALSTORM_STATS
+  }
+  inline void count_write_varint([[maybe_unused]] size_t const bytes) {
+    /// Record a varint write of the given encoded size, including its size band
+    #ifdef SERIALSTORM_STATS
+      count_write(&stream_stats::direction::varint, bytes);
+      ++stats_data.write.varint_sizes[bytes];
+    #endif // SERIALSTORM_STATS
+  }
+
   #ifdef SERIALSTORM_DEBUG_VERIFY
     inline void check_verification(std::string const &header,
                                    std::string const &function_name = __PRETTY_FUNCTION__) const {
@@ -336,6 +1366,15 @@ private:
       }
     }
 
+    inline errc try_check_verification(std::string const &header) const {
+      /// Verify a custom specified debugging header we expect from the stream, reporting errors instead of throwing
+      std::string data(header.length(), '?');
+      if(errc const error = static_cast<StreamT<StreamParam> const*>(this)->try_read_buffer(&data[0], data.length()); error != errc::NONE) {
+        return error;
+      }
+      return data == header ? errc::NONE : errc::VERIFICATION_FAILED;
+    }
+
     inline void write_verification(std::string const &header) {
       /// Write a custom specified debugging header into the stream
       static_cast<StreamT<StreamParam>*>(this)->write_buffer(header.c_str(), header.length());
@@ -0,0 +1,436 @@
+#pragma once
+
+/// Datagram streams, for unreliable real-time messages over UDP without
+/// head-of-line blocking.  Each message is built in memory as one datagram,
+/// bounded by the MTU, and sent in batches with a single sendmmsg() per
+/// batch.  Datagrams are received in batches with recvmmsg(), and each is
+/// decoded in place with the normal read functions, which can never read past
+/// the end of the datagram into the next.  Works on any datagram socket's
+/// file descriptor, such as the native_handle() of an asio UDP socket.  POSIX
+/// only; sendmmsg and recvmmsg are used on Linux, and one call per datagram
+/// elsewhere.
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "stream_base.h"
+#include "fd_sink.h"
+
+namespace serialstorm {
+
+class datagram_socket {
+  /// Batched sending and receiving of whole datagrams on a datagram socket,
+  /// which it doesn't own.  Outgoing datagrams are built in place in a batch
+  /// of MTU-sized slots, and incoming ones are received into another
+  struct slot {
+    size_t size{0};
+    sockaddr_storage address{};                                                 // destination when sending, source when receiving
+    socklen_t address_length{0};
+    bool truncated{false};                                                      // received datagram was larger than the MTU, so is incomplete
+  };
+
+  int const fd;
+  size_t const mtu;
+  size_t const batch_max;
+
+  std::vector<char> send_buffer;                                                // batch_max slots of mtu bytes each
+  std::vector<slot> send_slots;
+  size_t send_count{0};                                                         // finished datagrams waiting to be sent
+  size_t building_size{0};                                                      // bytes written so far to the datagram being built
+
+  std::vector<char> receive_buffer;
+  std::vector<slot> receive_slots;
+  size_t receive_count{0};                                                      // datagrams received in the last batch
+  size_t receive_next{0};                                                       // index of the next datagram to decode
+  char const *current{nullptr};                                                 // the datagram being decoded
+  size_t current_size{0};
+  size_t read_offset{0};
+
+  #ifdef __linux__
+    std::vector<iovec> send_vectors;                                            // message headers for sendmmsg and recvmmsg, pointing into the slots
+    std::vector<mmsghdr> send_headers;
+    std::vector<iovec> receive_vectors;
+    std::vector<mmsghdr> receive_headers;
+  #endif // __linux__
+
+public:
+  static constexpr size_t udp_ipv4_mtu{1500 - 20 - 8};                          // an ethernet frame less IPv4 and UDP headers, so datagrams are never fragmented
+
+  explicit datagram_socket(int const this_fd, size_t const this_mtu = udp_ipv4_mtu, size_t const this_batch_max = 32)
+    : fd(this_fd),
+      mtu(this_mtu),
+      batch_max(std::max(this_batch_max, size_t{1})),
+      send_buffer(mtu * batch_max),
+      send_slots(batch_max),
+      receive_buffer(mtu * batch_max),
+      receive_slots(batch_max) {
+    /// Specific constructor, with the largest datagram to send or receive and
+    /// the number of datagrams to send or receive with each system call
+    #ifdef __linux__
+      send_vectors.resize(batch_max);
+      send_headers.resize(batch_max);
+      receive_vectors.resize(batch_max);
+      receive_headers.resize(batch_max);
+      for(size_t i = 0; i != batch_max; ++i) {
+        send_vectors[i].iov_base = send_buffer.data() + i * mtu;
+        send_headers[i].msg_hdr.msg_iov = &send_vectors[i];
+        send_headers[i].msg_hdr.msg_iovlen = 1;
+        receive_vectors[i] = iovec{receive_buffer.data() + i * mtu, mtu};
+        receive_headers[i].msg_hdr.msg_iov = &receive_vectors[i];
+        receive_headers[i].msg_hdr.msg_iovlen = 1;
+        receive_headers[i].msg_hdr.msg_name = &receive_slots[i].address;
+      }
+    #endif // __linux__
+  }
+
+  datagram_socket(datagram_socket const&) = delete;
+  datagram_socket &operator=(datagram_socket const&) = delete;
+
+  inline int native_handle() const {
+    /// Access the socket's file descriptor
+    return fd;
+  }
+
+  inline size_t max_datagram_size() const {
+    /// Report the largest datagram that can be sent or received
+    return mtu;
+  }
+
+  // sending
+
+  inline void append(char const *data, size_t const size) {
+    /// Append data to the datagram being built.  If it wouldn't fit, the
+    /// whole datagram is discarded, as it could never be sent intact
+    if(size > mtu - building_size) {
+      std::stringstream ss;
+      ss << "SerialStorm: datagram of " << (building_size + size) << " bytes would exceed the limit of " << mtu << ", discarding it.";
+      building_size = 0;
+      REPORT_ERROR_NORETURN
+    }
+    if(size == 0) {
+      return;
+    }
+    std::memcpy(send_buffer.data() + send_count * mtu + building_size, data, size);
+    building_size += size;
+  }
+
+  inline size_t pending_size() const {
+    /// Report the size of the datagram being built so far
+    return building_size;
+  }
+
+  inline void end_datagram(sockaddr const *destination = nullptr, socklen_t const destination_length = 0) {
+    /// Finish the datagram being built and queue it to send, to the given
+    /// destination or to the socket's connected peer, sending the whole batch
+    /// once it's full.  Empty datagrams are sent too
+    slot &finished(send_slots[send_count]);
+    finished.size = building_size;
+    finished.address_length = destination ? destination_length : 0;
+    if(destination) {
+      std::memcpy(&finished.address, destination, std::min(static_cast<size_t>(destination_length), sizeof(finished.address)));
+    }
+    building_size = 0;
+    if(++send_count == batch_max) {
+      flush();
+    }
+  }
+
+  size_t flush() {
+    /// Send every finished datagram, in as few system calls as possible.
+    /// Returns the number sent; any the socket has no room for right now are
+    /// dropped, as the network itself might drop them
+    size_t const count(send_count);
+    size_t sent{0};
+    int error{0};
+    #ifdef __linux__
+      for(size_t i = 0; i != count; ++i) {
+        send_vectors[i].iov_len = send_slots[i].size;
+        send_headers[i].msg_hdr.msg_name = send_slots[i].address_length == 0 ? nullptr : &send_slots[i].address;
+        send_headers[i].msg_hdr.msg_namelen = send_slots[i].address_length;
+      }
+      while(sent != count) {
+        int const result(::sendmmsg(fd, send_headers.data() + sent, static_cast<unsigned int>(count - sent), 0));
+        if(result < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          error = errno;
+          break;
+        }
+        sent += static_cast<size_t>(result);
+      }
+    #else
+      while(sent != count) {
+        iovec vector{send_buffer.data() + sent * mtu, send_slots[sent].size};
+        msghdr header{};
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        if(send_slots[sent].address_length != 0) {
+          header.msg_name = &send_slots[sent].address;
+          header.msg_namelen = send_slots[sent].address_length;
+        }
+        if(::sendmsg(fd, &header, 0) < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          error = errno;
+          break;
+        }
+        ++sent;
+      }
+    #endif // __linux__
+    if(building_size != 0) {                                                    // keep a datagram still being built, moving it to the first slot
+      std::memmove(send_buffer.data(), send_buffer.data() + count * mtu, building_size);
+    }
+    send_count = 0;
+    if(error != 0 && error != EAGAIN && error != EWOULDBLOCK && error != ENOBUFS) { // a full socket buffer just drops the rest
+      errno = error;
+      report_error("sending datagrams");
+    }
+    return sent;
+  }
+
+  // receiving
+
+  size_t receive(bool const wait = true) {
+    /// Receive a batch of datagrams, waiting for at least one if wait is set,
+    /// and discarding any not yet decoded from the last batch.  Returns the
+    /// number received, which is 0 if not waiting and none were ready
+    receive_count = 0;
+    receive_next = 0;
+    current = nullptr;
+    current_size = 0;
+    read_offset = 0;
+    #ifdef __linux__
+      for(size_t i = 0; i != batch_max; ++i) {
+        receive_headers[i].msg_hdr.msg_namelen = sizeof(receive_slots[i].address);
+      }
+      int result;
+      do {
+        result = ::recvmmsg(fd, receive_headers.data(), static_cast<unsigned int>(batch_max), wait ? MSG_WAITFORONE : MSG_DONTWAIT, nullptr);
+      } while(result < 0 && errno == EINTR);
+      if(result < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+          report_error("receiving datagrams");
+        }
+        return 0;
+      }
+      for(size_t i = 0; i != static_cast<size_t>(result); ++i) {
+        receive_slots[i].size = std::min(static_cast<size_t>(receive_headers[i].msg_len), mtu);
+        receive_slots[i].address_length = receive_headers[i].msg_hdr.msg_namelen;
+        receive_slots[i].truncated = (receive_headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+      }
+      receive_count = static_cast<size_t>(result);
+    #else
+      while(receive_count != batch_max) {
+        iovec vector{receive_buffer.data() + receive_count * mtu, mtu};
+        msghdr header{};
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_name = &receive_slots[receive_count].address;
+        header.msg_namelen = sizeof(receive_slots[receive_count].address);
+        ssize_t const result(::recvmsg(fd, &header, wait && receive_count == 0 ? 0 : MSG_DONTWAIT));
+        if(result < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            report_error("receiving datagrams");
+          }
+          break;
+        }
+        receive_slots[receive_count].size = std::min(static_cast<size_t>(result), mtu);
+        receive_slots[receive_count].address_length = header.msg_namelen;
+        receive_slots[receive_count].truncated = (header.msg_flags & MSG_TRUNC) != 0;
+        ++receive_count;
+      }
+    #endif // __linux__
+    return receive_count;
+  }
+
+  inline bool next() {
+    /// Move on to decoding the next datagram received, skipping any that
+    /// were truncated.  Returns false once the batch is used up
+    for(; receive_next != receive_count; ++receive_next) {
+      if(!receive_slots[receive_next].truncated) {
+        current = receive_buffer.data() + receive_next * mtu;
+        current_size = receive_slots[receive_next].size;
+        read_offset = 0;
+        ++receive_next;
+        return true;
+      }
+    }
+    current = nullptr;
+    current_size = 0;
+    read_offset = 0;
+    return false;
+  }
+
+  inline std::string_view datagram() const {
+    /// Access the part of the current datagram not yet read, in place
+    return std::string_view(current + read_offset, current_size - read_offset);
+  }
+
+  inline size_t remaining() const {
+    /// Report the number of bytes left to read in the current datagram
+    return current_size - read_offset;
+  }
+
+  inline sockaddr_storage const &source() const {
+    /// Access the address the current datagram came from, once next() has
+    /// moved to it
+    return receive_slots[receive_next - 1].address;
+  }
+  inline socklen_t source_length() const {
+    return receive_slots[receive_next - 1].address_length;
+  }
+
+  inline bool read(char *data, size_t const size) {
+    /// Consume size bytes from the current datagram, copying them to data if
+    /// it isn't null.  Returns false without reading anything if the datagram
+    /// holds fewer
+    if(size > remaining()) {
+      return false;
+    }
+    if(data && size != 0) {
+      std::memcpy(data, current + read_offset, size);
+    }
+    read_offset += size;
+    return true;
+  }
+
+private:
+  static inline void report_error(char const *action) {
+    /// Report a failed system call, with the reason given by errno
+    std::stringstream ss;
+    ss << "SerialStorm: " << action << " failed: " << std::strerror(errno);
+    REPORT_ERROR_NORETURN
+  }
+};
+
+template<typename SocketT>
+class stream_datagram : public stream_base<SocketT, stream_datagram> {
+  /// Stream handler for datagrams: writes build the next datagram to send,
+  /// and reads decode the current datagram received, in place.  Messages are
+  /// delimited with end_datagram() on the socket when writing, and next() when
+  /// reading
+public:
+  SocketT &socket;
+
+  constexpr explicit stream_datagram(SocketT &this_socket)
+    : socket(this_socket) {
+    /// Specific constructor
+  }
+
+  stream_datagram(const stream_datagram&) = delete;
+
+  stream_datagram& operator=(const stream_datagram&) = delete;
+
+  template<typename T>
+  void read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the current datagram to the target buffer
+    if(!socket.read(reinterpret_cast<char*>(data), size)) {
+      std::stringstream ss;
+      ss << "SerialStorm: short read on datagram: " << socket.remaining() << " available out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  template<typename T>
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the current datagram to the target buffer, reporting a short read instead of throwing
+    return socket.read(reinterpret_cast<char*>(data), size) ? errc::NONE : errc::SHORT_READ;
+  }
+
+  void skip_bytes(size_t const size) const {
+    /// Discard a block of data of the specified size from the current datagram
+    if(!socket.read(nullptr, size)) {
+      std::stringstream ss;
+      ss << "SerialStorm: short skip on datagram: " << socket.remaining() << " available out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  void read_blob_to_fd(int const fd, size_t const size, int64_t const offset) const {
+    /// Write a block of data of the specified size from the current datagram straight to a file descriptor
+    std::string_view const data(socket.datagram());
+    if(size > data.size()) {
+      std::stringstream ss;
+      ss << "SerialStorm: short read on datagram: " << data.size() << " available out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+    detail::fd_sink sink(fd, offset);
+    sink.write(data.data(), size);
+    socket.read(nullptr, size);
+  }
+
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
+    /// Read size bytes from the current datagram into a string
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      read_buffer(data, size);
+    });
+  }
+
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
+    /// Read size bytes from the current datagram into a vector blob
+    std::vector<T, Allocator> blob(size, allocator);
+    read_buffer(blob.data(), blob.size() * sizeof(T));
+    return blob;
+  }
+
+  template<typename T>
+  static constexpr size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of a native buffer, for position tracking
+    return sizeof(buffer);
+  }
+
+  template<typename T>
+  inline void write_buffer(T const &buffer) {
+    /// Append a native buffer of char const* (or whatever implicitly converts to that) to the datagram being built
+    write_buffer(buffer, sizeof(buffer));
+  }
+  template<typename T>
+  inline void write_buffer(T const *data, size_t const size) {
+    /// Append a block of data of the specified size to the datagram being built from the target buffer
+    socket.append(reinterpret_cast<char const*>(data), size);
+  }
+
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Append a sequence of contiguous buffers to the datagram being built
+    for(auto const &buffer : buffers) {
+      socket.append(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+    }
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
+    /// Append a string to the datagram being built
+    write_buffer(string.data(), string.size() * sizeof(T));
+  }
+
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob) {
+    /// Append a blob to the datagram being built
+    write_blob(blob, blob.size() * sizeof(T));
+  }
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob, size_t const size) {
+    /// Append a blob of specific size to the datagram being built
+    write_buffer(blob.data(), size);
+  }
+};
+
+}
+
+#endif // _WIN32
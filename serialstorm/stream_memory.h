@@ -0,0 +1,163 @@
+#pragma once
+
+#include "stream_base.h"
+#include <cstring>
+#ifndef _WIN32
+  #include "fd_sink.h"
+#endif // _WIN32
+
+namespace serialstorm {
+
+template<typename StreamT>
+class stream_memory : public stream_base<StreamT, stream_memory> {
+  /// Stream handler to manage an in-memory buffer.  Writing appends to a
+  /// resizable contiguous container of char, such as std::vector<char> or
+  /// std::string.  Reading consumes from the start of any contiguous range of
+  /// char with data() and size(), including std::string_view, so a stream can
+  /// be read from memory it doesn't own.
+public:
+  StreamT &stream;
+  mutable size_t read_offset{0};                                                // position of the next byte to read
+
+  constexpr explicit stream_memory(StreamT &new_stream)
+    : stream(new_stream) {
+    /// Specific constructor
+  }
+
+  stream_memory(const stream_memory&) = delete;
+
+  stream_memory& operator=(const stream_memory&) = delete;
+
+  inline size_t remaining() const {
+    /// Report the number of bytes left to read
+    return stream.size() - read_offset;
+  }
+
+  template<typename T>
+  void read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from memory to the target buffer
+    if(size > remaining()) {
+      std::stringstream ss;
+      ss << "SerialStorm: short read on memory stream: " << remaining() << " available out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+    if(size == 0) {                                                             // empty containers may pass a null pointer, which memcpy must never see
+      return;
+    }
+    std::memcpy(data, stream.data() + read_offset, size);
+    read_offset += size;
+  }
+
+  template<typename T>
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from memory to the target buffer, reporting a short read instead of throwing
+    if(size > remaining()) {
+      return errc::SHORT_READ;
+    }
+    if(size == 0) {                                                             // empty containers may pass a null pointer, which memcpy must never see
+      return errc::NONE;
+    }
+    std::memcpy(data, stream.data() + read_offset, size);
+    read_offset += size;
+    return errc::NONE;
+  }
+
+  void skip_bytes(size_t const size) const {
+    /// Discard a block of data of the specified size from memory without copying it
+    if(size > remaining()) {
+      std::stringstream ss;
+      ss << "SerialStorm: short skip on memory stream: " << remaining() << " available out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+    read_offset += size;
+  }
+
+  #ifndef _WIN32
+    void read_blob_to_fd(int const fd, size_t const size, int64_t const offset) const {
+      /// Write a block of data of the specified size from memory straight to a file descriptor
+      if(size > remaining()) {
+        std::stringstream ss;
+        ss << "SerialStorm: short read on memory stream: " << remaining() << " available out of " << size << " requested.";
+        REPORT_ERROR_NORETURN
+      }
+      detail::fd_sink sink(fd, offset);
+      sink.preallocate(size);
+      sink.write(stream.data() + read_offset, size);
+      read_offset += size;
+    }
+  #endif // _WIN32
+
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
+    /// Read size bytes from memory into a string
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      read_buffer(data, size);
+    });
+  }
+
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
+    /// Read size bytes from memory into a vector blob
+    std::vector<T, Allocator> blob(size, allocator);
+    read_buffer(blob.data(), blob.size() * sizeof(T));
+    return blob;
+  }
+
+  template<typename T>
+  static constexpr size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of a native buffer, for position tracking
+    return sizeof(buffer);
+  }
+
+  template<typename T>
+  inline void write_buffer(T const &buffer) {
+    /// Append a native buffer of char const* (or whatever implicitly converts to that) to memory
+    write_buffer(buffer, sizeof(buffer));
+  }
+  template<typename T>
+  inline void write_buffer(T const *data, size_t const size) {
+    /// Append a block of data of the specified size to memory from the target buffer
+    if(size == 0) {
+      return;
+    }
+    size_t const offset(stream.size());
+    stream.resize(offset + size);
+    std::memcpy(stream.data() + offset, data, size);
+  }
+
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Append a sequence of contiguous buffers to memory, growing it only once
+    size_t offset(stream.size());
+    size_t size{0};
+    for(auto const &buffer : buffers) {
+      size += buffer.size();
+    }
+    stream.resize(offset + size);
+    for(auto const &buffer : buffers) {
+      if(buffer.size() != 0) {
+        std::memcpy(stream.data() + offset, buffer.data(), buffer.size());
+        offset += buffer.size();
+      }
+    }
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
+    /// Append a string to memory
+    write_buffer(string.data(), string.size() * sizeof(T));
+  }
+
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob) {
+    /// Append a blob to memory
+    write_blob(blob, blob.size() * sizeof(T));
+  }
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob, size_t const size) {
+    /// Append a blob of specific size to memory
+    write_buffer(blob.data(), size);
+  }
+};
+
+}
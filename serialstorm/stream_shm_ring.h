@@ -0,0 +1,551 @@
+#pragma once
+
+/// Single-producer single-consumer ring buffer in shared memory, for
+/// exchanging messages between processes on the same host without a syscall
+/// or kernel copy per message.  The ring lives in a memfd or POSIX shared
+/// memory object, with its data area mapped twice back to back so that any
+/// run of up to its capacity is contiguous in memory, even across the wrap.
+/// The head and tail indices sit on separate cache lines, and each end only
+/// sleeps on a futex once the ring has stayed empty or full for a short spin,
+/// so the other end only makes a syscall to wake a sleeper.  Linux only.
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <string_view>
+#include <utility>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "stream_base.h"
+#include "fd_sink.h"
+
+namespace serialstorm {
+namespace detail {
+
+inline constexpr size_t shm_ring_line_size{64};                                 // cache line size, so each end's index is kept apart from the other's
+inline constexpr uint64_t shm_ring_magic{0x676e6972'6d726f74};                  // marks a mapping as a ring, and the layout version
+inline constexpr unsigned int shm_ring_spin_count{1024};                        // polls of the other end's index before sleeping
+
+struct shm_ring_control {
+  /// Control block at the start of the shared mapping, ahead of the data
+  alignas(shm_ring_line_size) uint64_t magic;
+  uint64_t capacity;                                                            // size of the data area in bytes, a power of two
+  alignas(shm_ring_line_size) std::atomic<uint64_t> head;                       // total bytes ever written, only stored by the producer
+  std::atomic<uint32_t> data_sequence;                                          // futex word, bumped to wake a consumer waiting for data
+  std::atomic<uint32_t> consumer_waiting;
+  alignas(shm_ring_line_size) std::atomic<uint64_t> tail;                       // total bytes ever read, only stored by the consumer
+  std::atomic<uint32_t> space_sequence;                                         // futex word, bumped to wake a producer waiting for space
+  std::atomic<uint32_t> producer_waiting;
+  alignas(shm_ring_line_size) std::atomic<uint32_t> closed;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "SerialStorm: shared memory rings need lock-free atomics, which work across processes");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "SerialStorm: shared memory ring futex words must be plain 32-bit integers");
+
+inline void shm_ring_relax() {
+  /// Hint to the processor that this is a spin-wait loop
+  #if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+  #elif defined(__aarch64__)
+    asm volatile("yield");
+  #endif
+}
+
+inline void shm_ring_futex_wait(std::atomic<uint32_t> &word, uint32_t const expected) {
+  /// Sleep until woken, unless the word no longer holds the expected value.
+  /// Not FUTEX_PRIVATE, as the waker may be in another process
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+inline void shm_ring_futex_wake(std::atomic<uint32_t> &word) {
+  /// Wake every thread sleeping on the word
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+}
+
+}
+
+class shm_ring {
+  /// A mapping of a shared memory ring, owning its file descriptor.  One
+  /// process creates the ring and passes the descriptor or name to the other,
+  /// which opens its own mapping of it.  Each end then wraps its mapping in a
+  /// stream_shm_ring, one to write and one to read
+  int fd{-1};
+  char *mapping{nullptr};
+  size_t mapping_size{0};
+  size_t data_capacity{0};
+  detail::shm_ring_control *control_block{nullptr};
+  char *data_area{nullptr};
+
+public:
+  shm_ring() = default;
+  shm_ring(shm_ring const&) = delete;
+  shm_ring &operator=(shm_ring const&) = delete;
+  shm_ring(shm_ring &&other) noexcept
+    : fd(std::exchange(other.fd, -1)),
+      mapping(std::exchange(other.mapping, nullptr)),
+      mapping_size(std::exchange(other.mapping_size, 0)),
+      data_capacity(std::exchange(other.data_capacity, 0)),
+      control_block(std::exchange(other.control_block, nullptr)),
+      data_area(std::exchange(other.data_area, nullptr)) {
+    /// Move constructor
+  }
+  shm_ring &operator=(shm_ring &&other) noexcept {
+    /// Move assignment
+    if(this != &other) {
+      release();
+      fd = std::exchange(other.fd, -1);
+      mapping = std::exchange(other.mapping, nullptr);
+      mapping_size = std::exchange(other.mapping_size, 0);
+      data_capacity = std::exchange(other.data_capacity, 0);
+      control_block = std::exchange(other.control_block, nullptr);
+      data_area = std::exchange(other.data_area, nullptr);
+    }
+    return *this;
+  }
+
+  ~shm_ring() {
+    /// Unmap the ring and close its descriptor; the ring itself lives on while
+    /// the other end still has it mapped
+    release();
+  }
+
+  static shm_ring create(size_t const capacity) {
+    /// Create an anonymous ring in a memfd, with at least the given capacity
+    /// in bytes, rounded up to a power of two of at least one page.  Share it
+    /// with another process by passing native_handle() over a unix socket, or
+    /// by inheriting it across fork()
+    int const new_fd(::memfd_create("serialstorm_ring", MFD_CLOEXEC));
+    if(new_fd < 0) {
+      std::stringstream ss;
+      ss << "SerialStorm: creating a shared memory ring failed: " << std::strerror(errno);
+      REPORT_ERROR
+    }
+    return initialise(new_fd, capacity);
+  }
+
+  static shm_ring create_named(char const *name, size_t const capacity) {
+    /// Create a ring in a new POSIX shared memory object, such as "/my_ring",
+    /// for another process to open by name.  The name persists until removed
+    /// with shm_unlink(), which may be done as soon as both ends have opened it
+    int const new_fd(::shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+    if(new_fd < 0) {
+      std::stringstream ss;
+      ss << "SerialStorm: creating shared memory ring " << name << " failed: " << std::strerror(errno);
+      REPORT_ERROR
+    }
+    return initialise(new_fd, capacity);
+  }
+
+  static shm_ring open(int const existing_fd) {
+    /// Map an existing ring from its file descriptor, taking ownership of it
+    struct stat status;
+    if(::fstat(existing_fd, &status) != 0 || static_cast<size_t>(status.st_size) <= page_size()) {
+      ::close(existing_fd);
+      std::stringstream ss;
+      ss << "SerialStorm: file descriptor " << existing_fd << " is not a shared memory ring";
+      REPORT_ERROR
+    }
+    shm_ring ring;
+    ring.fd = existing_fd;
+    if(!ring.map(static_cast<size_t>(status.st_size) - page_size())) {
+      std::stringstream ss;
+      ss << "SerialStorm: mapping a shared memory ring failed: " << std::strerror(errno);
+      REPORT_ERROR
+    }
+    if(ring.control_block->magic != detail::shm_ring_magic || ring.control_block->capacity != ring.capacity()) {
+      std::stringstream ss;
+      ss << "SerialStorm: file descriptor " << existing_fd << " is not a shared memory ring, or is from an incompatible version";
+      REPORT_ERROR
+    }
+    return ring;
+  }
+
+  static shm_ring open_named(char const *name) {
+    /// Map an existing ring from the name of its POSIX shared memory object
+    int const existing_fd(::shm_open(name, O_RDWR | O_CLOEXEC, 0));
+    if(existing_fd < 0) {
+      std::stringstream ss;
+      ss << "SerialStorm: opening shared memory ring " << name << " failed: " << std::strerror(errno);
+      REPORT_ERROR
+    }
+    return open(existing_fd);
+  }
+
+  inline bool is_open() const {
+    /// Report whether this holds a mapped ring
+    return control_block != nullptr;
+  }
+
+  inline int native_handle() const {
+    /// Access the file descriptor, to share the ring with another process
+    return fd;
+  }
+
+  inline size_t capacity() const {
+    /// Report the size of the data area in bytes
+    return data_capacity;
+  }
+
+  inline detail::shm_ring_control &control() const {
+    /// Access the control block shared by both ends
+    return *control_block;
+  }
+
+  inline char *data() const {
+    /// Access the start of the data area, which is followed by a second mapping of itself
+    return data_area;
+  }
+
+  inline void close() const {
+    /// Mark the ring closed from either end, waking the other.  A consumer can
+    /// still read anything written before the ring was closed, after which
+    /// reads come up short; a producer can no longer wait for space
+    control_block->closed.store(1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    control_block->data_sequence.fetch_add(1, std::memory_order_release);
+    control_block->space_sequence.fetch_add(1, std::memory_order_release);
+    detail::shm_ring_futex_wake(control_block->data_sequence);
+    detail::shm_ring_futex_wake(control_block->space_sequence);
+  }
+
+  inline bool is_closed() const {
+    /// Report whether either end has closed the ring
+    return control_block->closed.load(std::memory_order_acquire) != 0;
+  }
+
+  inline uint64_t wait_for_data(uint64_t const position) const {
+    /// Wait until the producer has written beyond position, or the ring is
+    /// closed, and return the head.  Spins briefly before sleeping
+    for(unsigned int spin = 0; spin != detail::shm_ring_spin_count; ++spin) {
+      uint64_t const head(control_block->head.load(std::memory_order_acquire));
+      if(head != position || is_closed()) {
+        return head;
+      }
+      detail::shm_ring_relax();
+    }
+    for(;;) {
+      uint32_t const sequence(control_block->data_sequence.load(std::memory_order_acquire));
+      control_block->consumer_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);                      // pairs with the fence in notify_data, so either the producer sees us waiting or we see its head
+      uint64_t const head(control_block->head.load(std::memory_order_acquire));
+      if(head != position || is_closed()) {
+        control_block->consumer_waiting.store(0, std::memory_order_relaxed);
+        return head;
+      }
+      detail::shm_ring_futex_wait(control_block->data_sequence, sequence);
+    }
+  }
+
+  inline uint64_t wait_for_space(uint64_t const head) const {
+    /// Wait until the consumer has made room to write at head, or the ring is
+    /// closed, and return the tail.  Spins briefly before sleeping
+    uint64_t const full_tail(head - capacity());
+    for(unsigned int spin = 0; spin != detail::shm_ring_spin_count; ++spin) {
+      uint64_t const tail(control_block->tail.load(std::memory_order_acquire));
+      if(tail != full_tail || is_closed()) {
+        return tail;
+      }
+      detail::shm_ring_relax();
+    }
+    for(;;) {
+      uint32_t const sequence(control_block->space_sequence.load(std::memory_order_acquire));
+      control_block->producer_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);                      // pairs with the fence in notify_space
+      uint64_t const tail(control_block->tail.load(std::memory_order_acquire));
+      if(tail != full_tail || is_closed()) {
+        control_block->producer_waiting.store(0, std::memory_order_relaxed);
+        return tail;
+      }
+      detail::shm_ring_futex_wait(control_block->space_sequence, sequence);
+    }
+  }
+
+  inline void notify_data() const {
+    /// Wake the consumer after publishing a new head, if it's asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(control_block->consumer_waiting.load(std::memory_order_relaxed) && control_block->consumer_waiting.exchange(0, std::memory_order_relaxed)) { // only the first write after it sleeps pays for the wake
+      control_block->data_sequence.fetch_add(1, std::memory_order_release);
+      detail::shm_ring_futex_wake(control_block->data_sequence);
+    }
+  }
+
+  inline void notify_space() const {
+    /// Wake the producer after publishing a new tail, if it's asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(control_block->producer_waiting.load(std::memory_order_relaxed) && control_block->producer_waiting.exchange(0, std::memory_order_relaxed)) { // only the first read after it sleeps pays for the wake
+      control_block->space_sequence.fetch_add(1, std::memory_order_release);
+      detail::shm_ring_futex_wake(control_block->space_sequence);
+    }
+  }
+
+private:
+  static inline size_t page_size() {
+    /// The control block takes one page, so the data area can be mapped at a page offset
+    static size_t const size(static_cast<size_t>(::sysconf(_SC_PAGESIZE)));
+    return size;
+  }
+
+  static shm_ring initialise(int const new_fd, size_t const capacity) {
+    /// Size a newly created shared memory object, map it and set up its control block
+    size_t rounded_capacity(page_size());
+    while(rounded_capacity < capacity) {
+      rounded_capacity *= 2;
+    }
+    shm_ring ring;
+    ring.fd = new_fd;
+    if(::ftruncate(new_fd, static_cast<off_t>(page_size() + rounded_capacity)) != 0 || !ring.map(rounded_capacity)) {
+      std::stringstream ss;
+      ss << "SerialStorm: setting up a shared memory ring of " << rounded_capacity << " bytes failed: " << std::strerror(errno);
+      REPORT_ERROR
+    }
+    detail::shm_ring_control *const control(new(ring.mapping) detail::shm_ring_control{});
+    control->capacity = rounded_capacity;
+    control->magic = detail::shm_ring_magic;
+    return ring;
+  }
+
+  bool map(size_t const capacity) {
+    /// Map the control block followed by the data area twice over, into one
+    /// reserved range of address space so the two copies are adjacent
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity % page_size() != 0) {
+      errno = EINVAL;
+      return false;
+    }
+    size_t const size(page_size() + capacity * 2);
+    void *const reserved(::mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(reserved == MAP_FAILED) {
+      return false;
+    }
+    char *const base(static_cast<char*>(reserved));
+    mapping = base;
+    mapping_size = size;
+    if(::mmap(base, page_size() + capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+       ::mmap(base + page_size() + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(page_size())) == MAP_FAILED) {
+      return false;
+    }
+    control_block = reinterpret_cast<detail::shm_ring_control*>(base);
+    data_area = base + page_size();
+    data_capacity = capacity;
+    return true;
+  }
+
+  void release() {
+    /// Unmap and close whatever this holds
+    if(mapping) {
+      ::munmap(mapping, mapping_size);
+    }
+    if(fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+    mapping = nullptr;
+    mapping_size = 0;
+    data_capacity = 0;
+    control_block = nullptr;
+    data_area = nullptr;
+  }
+};
+
+template<typename RingT>
+class stream_shm_ring : public stream_base<RingT, stream_shm_ring> {
+  /// Stream handler for one end of a shared memory ring: a process writes to
+  /// a ring through one of these and the other reads from it through another.
+  /// Each end keeps the last index it saw of the other, so it only touches the
+  /// other end's cache line when it runs out of data or space
+public:
+  RingT &ring;
+  mutable uint64_t head_seen;                                                   // consumer's latest view of the producer's head
+  uint64_t tail_seen;                                                           // producer's latest view of the consumer's tail
+
+  explicit stream_shm_ring(RingT &this_ring)
+    : ring(this_ring),
+      head_seen(this_ring.control().head.load(std::memory_order_acquire)),
+      tail_seen(this_ring.control().tail.load(std::memory_order_acquire)) {
+    /// Specific constructor
+  }
+
+  stream_shm_ring(const stream_shm_ring&) = delete;
+
+  stream_shm_ring& operator=(const stream_shm_ring&) = delete;
+
+  std::string_view peek(size_t size) const {
+    /// Wait until size bytes are ready to read, and return a view of them in
+    /// the shared mapping without consuming them, so a message can be decoded
+    /// in place with a stream_memory before skip() releases it to the
+    /// producer.  The view is shorter if the ring is closed first, and size
+    /// is limited to the ring's capacity
+    size = std::min(size, ring.capacity());
+    uint64_t const tail(ring.control().tail.load(std::memory_order_relaxed));
+    while(head_seen - tail < size) {
+      uint64_t const head(ring.wait_for_data(head_seen));
+      if(head == head_seen) {                                                   // closed, and nothing more is coming
+        break;
+      }
+      head_seen = head;
+    }
+    return std::string_view(ring.data() + (tail & (ring.capacity() - 1)), std::min<uint64_t>(size, head_seen - tail));
+  }
+
+  template<typename T>
+  void read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the ring to the target buffer, waiting for it if need be
+    size_t const count(consume(size, [&](char const *source, size_t const offset, size_t const length){
+      std::memcpy(reinterpret_cast<char*>(data) + offset, source, length);
+    }));
+    if(count != size) {
+      std::stringstream ss;
+      ss << "SerialStorm: short read on shared memory ring: closed after " << count << " read out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  template<typename T>
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the ring to the target buffer, reporting a short read instead of throwing
+    size_t const count(consume(size, [&](char const *source, size_t const offset, size_t const length){
+      std::memcpy(reinterpret_cast<char*>(data) + offset, source, length);
+    }));
+    return count == size ? errc::NONE : errc::SHORT_READ;
+  }
+
+  void skip_bytes(size_t const size) const {
+    /// Discard a block of data of the specified size from the ring without copying it
+    size_t const count(consume(size, [](char const*, size_t, size_t){}));
+    if(count != size) {
+      std::stringstream ss;
+      ss << "SerialStorm: short skip on shared memory ring: closed after " << count << " skipped out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  void read_blob_to_fd(int const fd, size_t const size, int64_t const offset) const {
+    /// Write a block of data of the specified size from the shared mapping straight to a file descriptor
+    detail::fd_sink sink(fd, offset);
+    sink.preallocate(size);
+    size_t const count(consume(size, [&](char const *source, size_t, size_t const length){
+      sink.write(source, length);
+    }));
+    if(count != size) {
+      std::stringstream ss;
+      ss << "SerialStorm: short read on shared memory ring: closed after " << count << " read out of " << size << " requested.";
+      REPORT_ERROR_NORETURN
+    }
+  }
+
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
+    /// Read size bytes from the ring into a string
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      read_buffer(data, size);
+    });
+  }
+
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
+    /// Read size bytes from the ring into a vector blob
+    std::vector<T, Allocator> blob(size, allocator);
+    read_buffer(blob.data(), blob.size() * sizeof(T));
+    return blob;
+  }
+
+  template<typename T>
+  static constexpr size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of a native buffer, for position tracking
+    return sizeof(buffer);
+  }
+
+  template<typename T>
+  inline void write_buffer(T const &buffer) {
+    /// Write a native buffer of char const* (or whatever implicitly converts to that) to the ring
+    write_buffer(buffer, sizeof(buffer));
+  }
+  template<typename T>
+  inline void write_buffer(T const *data, size_t const size) {
+    /// Write a block of data of the specified size to the ring from the target buffer, waiting for space if need be
+    char const *source(reinterpret_cast<char const*>(data));
+    size_t remaining(size);
+    uint64_t head(ring.control().head.load(std::memory_order_relaxed));
+    while(remaining != 0) {
+      if(head - tail_seen == ring.capacity()) {
+        tail_seen = ring.wait_for_space(head);
+        if(head - tail_seen == ring.capacity()) {                               // closed while full, so the consumer has gone
+          std::stringstream ss;
+          ss << "SerialStorm: write to closed shared memory ring: " << (size - remaining) << " written out of " << size << " requested.";
+          REPORT_ERROR_NORETURN
+        }
+      }
+      size_t const count(static_cast<size_t>(std::min<uint64_t>(remaining, ring.capacity() - (head - tail_seen))));
+      std::memcpy(ring.data() + (head & (ring.capacity() - 1)), source, count); // contiguous even across the wrap, thanks to the second mapping
+      source += count;
+      remaining -= count;
+      head += count;
+      ring.control().head.store(head, std::memory_order_release);
+      ring.notify_data();
+    }
+  }
+
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Write a sequence of contiguous buffers to the ring one after another
+    for(auto const &buffer : buffers) {
+      write_buffer(buffer.data(), buffer.size());
+    }
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
+    /// Write a string to the ring
+    write_buffer(string.data(), string.size() * sizeof(T));
+  }
+
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob) {
+    /// Write a blob to the ring
+    write_blob(blob, blob.size() * sizeof(T));
+  }
+  template<typename T>
+  inline void write_blob(std::vector<T> const &blob, size_t const size) {
+    /// Write a blob of specific size to the ring
+    write_buffer(blob.data(), size);
+  }
+
+private:
+  template<typename Function>
+  size_t consume(size_t const size, Function &&function) const {
+    /// Pass up to size bytes to function(source, offset, length) in
+    /// contiguous pieces straight from the shared mapping, waiting for the
+    /// producer as need be, and release each piece back to it once done.
+    /// Returns the number of bytes consumed, short only if the ring is closed
+    uint64_t tail(ring.control().tail.load(std::memory_order_relaxed));
+    size_t done{0};
+    while(done != size) {
+      if(head_seen == tail) {
+        head_seen = ring.wait_for_data(tail);
+        if(head_seen == tail) {                                                 // closed, and everything written has been read
+          break;
+        }
+      }
+      size_t const count(static_cast<size_t>(std::min<uint64_t>(size - done, head_seen - tail)));
+      function(ring.data() + (tail & (ring.capacity() - 1)), done, count);
+      done += count;
+      tail += count;
+      ring.control().tail.store(tail, std::memory_order_release);
+      ring.notify_space();
+    }
+    return done;
+  }
+};
+
+}
+
+#endif // __linux__
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace serialstorm {
+
+struct stream_stats {
+  /// Per-stream operation and byte counters, populated by stream_base when
+  /// SERIALSTORM_STATS is defined.  Composite operations are counted as their
+  /// logical parts: a varstring counts as one varint and one string, a varblob
+  /// as one varint and one blob.  Only calls made through stream_base are seen.
+  struct counter {
+    uint64_t calls{0};                                                          // number of operations of this type
+    uint64_t bytes{0};                                                          // payload bytes moved by those operations
+  };
+
+  struct direction {
+    counter pod;
+    counter varint;                                                             // bytes include the size tag
+    counter string;
+    counter blob;
+    counter backend;                                                            // calls made into the underlying stream backend
+    std::array<uint64_t, 11> varint_sizes{};                                    // histogram of varints by encoded size in bytes, 1 to 10 depending on codec
+  };
+
+  direction read;
+  direction write;
+
+  void reset() {
+    /// Zero all counters
+    *this = stream_stats{};
+  }
+};
+
+}
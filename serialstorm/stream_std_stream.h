@@ -1,13 +1,47 @@
 #pragma once
 
 #include "stream_base.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <streambuf>
 #ifndef NDEBUG
   #include <iostream>
 #endif
 
 namespace serialstorm {
 
+namespace detail {
+
+struct streambuf_access : public std::streambuf {
+  /// Access to the protected get and put area pointers of any char stream
+  /// buffer, for the unformatted fast paths of stream_std_stream, by naming
+  /// the members through a derived class
+  static inline char *get_pointer(std::streambuf &buffer) {
+    return (buffer.*&streambuf_access::gptr)();
+  }
+  static inline char *get_end(std::streambuf &buffer) {
+    return (buffer.*&streambuf_access::egptr)();
+  }
+  static inline void get_bump(std::streambuf &buffer, int const count) {
+    (buffer.*&streambuf_access::gbump)(count);
+  }
+  static inline char *put_pointer(std::streambuf &buffer) {
+    return (buffer.*&streambuf_access::pptr)();
+  }
+  static inline char *put_end(std::streambuf &buffer) {
+    return (buffer.*&streambuf_access::epptr)();
+  }
+  static inline void put_bump(std::streambuf &buffer, int const count) {
+    (buffer.*&streambuf_access::pbump)(count);
+  }
+};
+
+}
+
 template<typename StreamT>
 class stream_std_stream : public stream_base<StreamT, stream_std_stream> {
   /// Stream handler to manage a std::istream, std::ostream, std::fstream etc
@@ -26,51 +60,102 @@ public:
   template<typename T>
   void read_buffer(T *data, size_t const size) const {
     /// Read a block of data of the specified size from the stream to the target buffer asynchronously
-    stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+    [[maybe_unused]] size_t const count(read_some(reinterpret_cast<char*>(data), size));
     #ifndef NDEBUG
-      if(!stream) {
+      if(count != size) {
         std::stringstream ss;
-        ss << "SerialStorm: short read on stream: " << stream.gcount() << " read out of " << size << " requested.";
+        ss << "SerialStorm: short read on stream: " << count << " read out of " << size << " requested.";
         REPORT_ERROR_NORETURN
       }
     #endif
   }
 
   template<typename T>
-  std::string read_string(T const stringlength) const {
-    /// Read size bytes from the stream into a string asynchronously
-    #ifdef NDEBUG
-      std::string string(stringlength, '\0');                                   // use null byte as default fill to minimise risk in release mode
-    #else
-      std::string string(stringlength, '?');                                    // use ? as a marker character to visibly show if we somehow end up with a short read
+  errc try_read_buffer(T *data, size_t const size) const {
+    /// Read a block of data of the specified size from the stream to the target buffer, reporting a short read instead of throwing
+    return read_some(reinterpret_cast<char*>(data), size) == size ? errc::NONE : errc::SHORT_READ;
+  }
+
+  void skip_bytes(size_t const size) const {
+    /// Discard a block of data of the specified size from the stream, seeking
+    /// past it where the stream supports that, and reading it otherwise.  A
+    /// file can be seeked past its end without error, so the seek stops short
+    /// of the last byte skipped, and only counts if that byte can be read
+    using traits = typename StreamT::traits_type;
+    if(size == 0) {
+      return;
+    }
+    auto *const buffer(stream.rdbuf());
+    if(buffer->pubseekoff(static_cast<std::streamoff>(size - 1), std::ios_base::cur, std::ios_base::in) != std::streampos(std::streamoff(-1))) {
+      if(!traits::eq_int_type(buffer->sbumpc(), traits::eof())) {
+        return;
+      }
+      buffer->pubseekoff(-static_cast<std::streamoff>(size - 1), std::ios_base::cur, std::ios_base::in); // past the end, so go back and read what there is, to report the short skip
+    }
+    stream.ignore(static_cast<std::streamsize>(size));                          // not seekable, or not that far, such as a pipe or the end of a stringstream
+    #ifndef NDEBUG
+      if(static_cast<size_t>(stream.gcount()) != size) {
+        std::stringstream ss;
+        ss << "SerialStorm: short skip on stream: " << stream.gcount() << " skipped out of " << size << " requested.";
+        REPORT_ERROR_NORETURN
+      }
     #endif
-    read_buffer(&string[0], string.size());                                     // copy-less string-filling buffer hack from http://stackoverflow.com/a/19623133/1678468
-    return string;
   }
 
-  template<typename T, typename SizeT>
-  std::vector<T> read_blob(SizeT const size) const {
+  template<typename T, typename StringT = std::string>
+  StringT read_string(T const stringlength, typename StringT::allocator_type const &allocator = {}) const {
+    /// Read size bytes from the stream into a string asynchronously
+    return make_string_for_overwrite<StringT>(stringlength, allocator, [this](char *data, size_t const size){
+      size_t const count(read_some(data, size));
+      if(count != size) {
+        #ifdef NDEBUG
+          std::fill(data + count, data + size, '\0');                           // short reads aren't reported in release mode, so never hand back uninitialised memory
+        #else
+          std::stringstream ss;
+          ss << "SerialStorm: short read on stream: " << count << " read out of " << size << " requested.";
+          REPORT_ERROR_NORETURN
+        #endif
+      }
+    });
+  }
+
+  template<typename T, typename SizeT, typename Allocator = std::allocator<T>>
+  std::vector<T, Allocator> read_blob(SizeT const size, Allocator const &allocator = {}) const {
     /// Read size bytes from the stream into a vector blob asynchronously
-    std::vector<T> blob(size);
+    std::vector<T, Allocator> blob(size, allocator);
     read_buffer(blob.data(), blob.size() * sizeof(T));
     return blob;
   }
 
+  template<typename T>
+  static constexpr size_t buffer_size(T const &buffer) {
+    /// Report the size in bytes of a native buffer, for position tracking
+    return sizeof(buffer);
+  }
+
   template<typename T>
   inline void write_buffer(T const &buffer) {
     /// Write a native buffer of char const* (or whatever implicitly converts to that) to the stream
-    stream.write(buffer, sizeof(buffer));
+    write_some(buffer, sizeof(buffer));
   }
   template<typename T>
   inline void write_buffer(T const *data, size_t const size) {
     /// Write a block of data of the specified size to the stream from the target buffer
-    stream.write(reinterpret_cast<char const*>(data), static_cast<std::streamsize>(size));
+    write_some(reinterpret_cast<char const*>(data), size);
   }
 
-  template<typename T>
-  inline void write_string(std::basic_string<T> const &string) {
+  template<typename Buffers>
+  inline void write_buffers(Buffers const &buffers) {
+    /// Write a sequence of contiguous buffers to the stream one after another
+    for(auto const &buffer : buffers) {
+      write_some(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+    }
+  }
+
+  template<typename T, typename Traits, typename Allocator>
+  inline void write_string(std::basic_string<T, Traits, Allocator> const &string) {
     /// Write a string to the stream
-    stream.write(string.c_str(), static_cast<std::streamsize>(string.size()));
+    write_some(reinterpret_cast<char const*>(string.data()), string.size() * sizeof(T));
   }
 
   template<typename T>
@@ -81,7 +166,58 @@ public:
   template<typename T>
   inline void write_blob(std::vector<T> const &blob, size_t const size) {
     /// Write a blob of specific size to the stream
-    stream.write(reinterpret_cast<char const*>(blob.data()), static_cast<std::streamsize>(size));
+    write_some(reinterpret_cast<char const*>(blob.data()), size);
+  }
+
+private:
+  inline size_t read_some(char *data, size_t const size) const {
+    /// Read up to size bytes, copying straight out of the stream buffer's get
+    /// area when it already holds them all, which skips the sentry and the
+    /// virtual call for small reads.  Otherwise fall back to sgetn, setting
+    /// the stream state as stream.read() would.  Returns the bytes read
+    if(stream.rdstate() == std::ios_base::goodbit && !stream.tie() && size != 0) { // a good stream always has a buffer
+      std::streambuf &buffer(*stream.rdbuf());
+      char *const get(detail::streambuf_access::get_pointer(buffer));
+      if(size <= static_cast<size_t>(detail::streambuf_access::get_end(buffer) - get) && size <= static_cast<size_t>(std::numeric_limits<int>::max())) {
+        std::memcpy(data, get, size);
+        detail::streambuf_access::get_bump(buffer, static_cast<int>(size));
+        return size;
+      }
+    }
+    std::istream &input(stream);
+    std::istream::sentry const sentry(input, true);                             // sets failbit on a stream that isn't good, as stream.read() does
+    if(!sentry) {
+      return 0;
+    }
+    size_t const count(static_cast<size_t>(input.rdbuf()->sgetn(data, static_cast<std::streamsize>(size))));
+    if(count != size) {
+      input.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+    }
+    return count;
+  }
+
+  inline void write_some(char const *data, size_t const size) {
+    /// Write size bytes, copying straight into the stream buffer's put area
+    /// when it has room for them all, which skips the sentry and the virtual
+    /// call for small writes.  Otherwise fall back to sputn, setting the
+    /// stream state as stream.write() would
+    if(stream.rdstate() == std::ios_base::goodbit && !stream.tie() && !(stream.flags() & std::ios_base::unitbuf) && size != 0) {
+      std::streambuf &buffer(*stream.rdbuf());
+      char *const put(detail::streambuf_access::put_pointer(buffer));
+      if(size <= static_cast<size_t>(detail::streambuf_access::put_end(buffer) - put) && size <= static_cast<size_t>(std::numeric_limits<int>::max())) {
+        std::memcpy(put, data, size);
+        detail::streambuf_access::put_bump(buffer, static_cast<int>(size));
+        return;
+      }
+    }
+    std::ostream &output(stream);
+    std::ostream::sentry const sentry(output);                                  // flushes on destruction if unitbuf is set
+    if(!sentry) {
+      return;
+    }
+    if(static_cast<size_t>(output.rdbuf()->sputn(data, static_cast<std::streamsize>(size))) != size) {
+      output.setstate(std::ios_base::badbit);
+    }
   }
 };
 
@@ -0,0 +1,82 @@
+#pragma once
+
+/// Session-scoped string dictionaries for interned varstrings.  The first
+/// time a string is sent it is assigned the next sequential id, and the id is
+/// sent followed by the string itself.  After that only the id is sent.  Both
+/// ends assign ids in the same order, so new ids never need to be sent
+/// separately: an id equal to the current dictionary size introduces a new
+/// string, and a smaller id refers back to one already sent.
+/// Each dictionary must only be used with a single stream, and the writer and
+/// reader must be created (or cleared) at the same point in the stream.
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace serialstorm {
+
+class string_dictionary_writer {
+  /// Sending side of a string dictionary
+  std::unordered_map<std::string, size_t> ids;
+
+public:
+  std::pair<size_t, bool> intern(std::string const &string) {
+    /// Look up the id of a string, adding it if it is new.  Returns the id,
+    /// and whether the string was added
+    auto const [it, inserted] = ids.try_emplace(string, ids.size());
+    return {it->second, inserted};
+  }
+
+  size_t size() const {
+    /// Report the number of strings interned so far
+    return ids.size();
+  }
+
+  void clear() {
+    /// Forget all strings interned so far, for example at the start of a new session
+    ids.clear();
+  }
+};
+
+class string_dictionary_reader {
+  /// Receiving side of a string dictionary
+  std::deque<std::string> strings;                                              // deque keeps references to existing strings valid as it grows
+
+public:
+  size_t entries_max{0};                                                        // optionally limit the number of strings a peer may intern, to prevent DOS attacks
+
+  string_dictionary_reader() = default;
+  explicit string_dictionary_reader(size_t const this_entries_max)
+    : entries_max(this_entries_max) {
+    /// Specific constructor
+  }
+
+  std::string_view operator[](size_t const id) const {
+    /// Access a previously interned string by id
+    return strings[id];
+  }
+
+  std::string_view add(std::string &&string) {
+    /// Intern a newly received string, assigning it the next id
+    return strings.emplace_back(std::move(string));
+  }
+
+  size_t size() const {
+    /// Report the number of strings interned so far
+    return strings.size();
+  }
+
+  bool full() const {
+    /// Report whether the maximum number of entries has been reached
+    return entries_max != 0 && strings.size() >= entries_max;
+  }
+
+  void clear() {
+    /// Forget all strings interned so far, for example at the start of a new session
+    strings.clear();
+  }
+};
+
+}
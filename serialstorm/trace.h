@@ -0,0 +1,178 @@
+#pragma once
+
+/// Latency tracing hooks around every call stream_base makes into a backend.
+/// Tracing is a compile-time switch: define SERIALSTORM_TRACE as the name of
+/// a policy type before including any SerialStorm stream header, for example:
+///   #include "serialstorm/trace.h"
+///   #define SERIALSTORM_TRACE serialstorm::trace_histogram
+///   #include "serialstorm/serialstorm.h"
+/// When SERIALSTORM_TRACE is not defined no tracing code is generated at all.
+///
+/// A policy is any type providing:
+///   using token = ...;                                                        // state carried from begin to end, e.g. a timestamp
+///   static token begin(trace_op op, size_t size) noexcept;
+///   static void end(trace_op op, size_t size, token const &start) noexcept;
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#if defined(__has_include)
+  #if __has_include(<sys/sdt.h>)
+    #include <sys/sdt.h>
+    #define SERIALSTORM_TRACE_HAS_SDT
+  #endif
+#endif
+
+namespace serialstorm {
+
+enum class trace_op : uint8_t {                                                 // the backend call being traced
+  READ_BUFFER,
+  READ_STRING,
+  WRITE_BUFFER,
+  WRITE_STRING,
+  WRITE_BLOB,
+  COUNT                                                                         // number of traced operations, not an operation itself
+};
+
+template<typename Policy>
+class trace_scope {
+  /// RAII helper to call a tracing policy's begin and end around a scope
+  trace_op const op;
+  size_t const size;
+  typename Policy::token const start;
+
+public:
+  trace_scope(trace_op const this_op, size_t const this_size) noexcept
+    : op(this_op),
+      size(this_size),
+      start(Policy::begin(this_op, this_size)) {
+    /// Specific constructor
+  }
+
+  trace_scope(trace_scope const&) = delete;
+  trace_scope &operator=(trace_scope const&) = delete;
+
+  ~trace_scope() {
+    Policy::end(op, size, start);
+  }
+};
+
+class trace_histogram {
+  /// Tracing policy recording the latency of each operation into a shared
+  /// log-linear histogram in the style of HdrHistogram.  Each power of two
+  /// range of nanoseconds is split into 16 linear sub-buckets, so recorded
+  /// values are accurate to within about 6%.  Recording is lock-free and safe
+  /// to use from any number of threads.
+public:
+  using clock = std::chrono::steady_clock;
+  using token = clock::time_point;
+
+  static constexpr unsigned int sub_bucket_bits = 4;
+  static constexpr size_t sub_bucket_count = size_t{1} << sub_bucket_bits;
+  static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+private:
+  static inline std::array<std::array<std::atomic<uint64_t>, bucket_count>, static_cast<size_t>(trace_op::COUNT)> counts{};
+
+public:
+  static token begin(trace_op /*op*/, size_t /*size*/) noexcept {
+    /// Policy hook: take a timestamp at the start of the operation
+    return clock::now();
+  }
+
+  static void end(trace_op const op, size_t /*size*/, token const &start) noexcept {
+    /// Policy hook: record the time elapsed since the start of the operation
+    record(op, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()));
+  }
+
+  static void record(trace_op const op, uint64_t const nanoseconds) noexcept {
+    /// Record a single latency value for the given operation
+    counts[static_cast<size_t>(op)][bucket_index(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static uint64_t count(trace_op const op) noexcept {
+    /// Report how many values have been recorded for the given operation
+    uint64_t total{0};
+    for(auto const &bucket : counts[static_cast<size_t>(op)]) {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  static uint64_t percentile(trace_op const op, double const percent) noexcept {
+    /// Report the latency in nanoseconds at or below which the given
+    /// percentage of the operations recorded fall, or 0 if there are none
+    uint64_t const total(count(op));
+    if(total == 0) {
+      return 0;
+    }
+    auto const target(static_cast<uint64_t>(static_cast<double>(total) * percent / 100.0));
+    uint64_t seen{0};
+    for(size_t index = 0; index != bucket_count; ++index) {
+      seen += counts[static_cast<size_t>(op)][index].load(std::memory_order_relaxed);
+      if(seen > target || seen == total) {
+        return bucket_upper_bound(index);
+      }
+    }
+    return bucket_upper_bound(bucket_count - 1);
+  }
+
+  static void reset() noexcept {
+    /// Discard all recorded values
+    for(auto &op_counts : counts) {
+      for(auto &bucket : op_counts) {
+        bucket.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  static constexpr size_t bucket_index(uint64_t const value) noexcept {
+    /// Find the histogram bucket a value falls into
+    if(value < sub_bucket_count) {                                              // small values map to buckets one-to-one
+      return static_cast<size_t>(value);
+    }
+    unsigned int magnitude{0};                                                  // index of the most significant bit
+    for(uint64_t remaining = value >> 1; remaining != 0; remaining >>= 1) {
+      ++magnitude;
+    }
+    unsigned int const shift(magnitude - sub_bucket_bits);
+    return (shift + 1) * sub_bucket_count + static_cast<size_t>((value >> shift) & (sub_bucket_count - 1));
+  }
+
+  static constexpr uint64_t bucket_upper_bound(size_t const index) noexcept {
+    /// Report the highest value that falls into the given bucket
+    if(index < sub_bucket_count) {
+      return index;
+    }
+    unsigned int const shift(static_cast<unsigned int>(index / sub_bucket_count) - 1);
+    uint64_t const sub_bucket((index % sub_bucket_count) + sub_bucket_count);
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+};
+
+struct trace_usdt {
+  /// Tracing policy firing the static user-space probes serialstorm:begin and
+  /// serialstorm:end, with the operation and size as arguments, for use with
+  /// perf, bpftrace, SystemTap and the like.  Probes are inactive nops until
+  /// a tracer attaches.  If <sys/sdt.h> is not available this does nothing.
+  using token = uint8_t;
+
+  static token begin([[maybe_unused]] trace_op const op, [[maybe_unused]] size_t const size) noexcept {
+    /// Policy hook: fire the begin probe
+    #ifdef SERIALSTORM_TRACE_HAS_SDT
+      DTRACE_PROBE2(serialstorm, begin, static_cast<unsigned int>(op), size);
+    #endif // SERIALSTORM_TRACE_HAS_SDT
+    return {};
+  }
+
+  static void end([[maybe_unused]] trace_op const op, [[maybe_unused]] size_t const size, token const &/*start*/) noexcept {
+    /// Policy hook: fire the end probe
+    #ifdef SERIALSTORM_TRACE_HAS_SDT
+      DTRACE_PROBE2(serialstorm, end, static_cast<unsigned int>(op), size);
+    #endif // SERIALSTORM_TRACE_HAS_SDT
+  }
+};
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/// Type traits used by stream_base to pick how a standard container or
+/// vocabulary type is serialised
+
+#include <array>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace serialstorm {
+
+template<typename T> struct is_std_string : std::false_type {};
+template<typename CharT, typename Traits, typename Allocator> struct is_std_string<std::basic_string<CharT, Traits, Allocator>> : std::true_type {};
+
+template<typename T> struct is_std_vector : std::false_type {};
+template<typename T, typename Allocator> struct is_std_vector<std::vector<T, Allocator>> : std::true_type {};
+
+template<typename T> struct is_std_array : std::false_type {};
+template<typename T, size_t N> struct is_std_array<std::array<T, N>> : std::true_type {};
+
+template<typename T> struct is_std_optional : std::false_type {};
+template<typename T> struct is_std_optional<std::optional<T>> : std::true_type {};
+
+template<typename T> struct is_std_variant : std::false_type {};
+template<typename... Ts> struct is_std_variant<std::variant<Ts...>> : std::true_type {};
+
+template<typename T> struct is_std_tuple : std::false_type {};
+template<typename... Ts> struct is_std_tuple<std::tuple<Ts...>> : std::true_type {};
+template<typename T1, typename T2> struct is_std_tuple<std::pair<T1, T2>> : std::true_type {};
+
+template<typename T, typename = void> struct is_map_like : std::false_type {};   // std::map, std::unordered_map and anything else with the same interface
+template<typename T> struct is_map_like<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::true_type {};
+
+template<typename T, typename = void> struct has_reserve : std::false_type {};
+template<typename T> struct has_reserve<T, std::void_t<decltype(std::declval<T&>().reserve(size_t{}))>> : std::true_type {};
+
+template<typename T> struct has_nonempty_encoding : std::true_type {};          // everything else takes at least a byte: a pod, or a length, flag or index prefix
+template<typename T, size_t N> struct has_nonempty_encoding<std::array<T, N>> : std::bool_constant<N != 0 && has_nonempty_encoding<T>::value> {};
+template<typename... Ts> struct has_nonempty_encoding<std::tuple<Ts...>> : std::bool_constant<(has_nonempty_encoding<std::remove_cv_t<Ts>>::value || ...)> {};
+template<typename T1, typename T2> struct has_nonempty_encoding<std::pair<T1, T2>> : std::bool_constant<has_nonempty_encoding<std::remove_cv_t<T1>>::value || has_nonempty_encoding<std::remove_cv_t<T2>>::value> {};
+
+template<typename Target, typename Allocator>
+inline Target convert_allocator([[maybe_unused]] Allocator const &allocator) {
+  /// Make the allocator for a nested string or container from the one given
+  /// for its parent, where one converts to the other (as any two
+  /// std::pmr::polymorphic_allocators do), or a default one otherwise
+  if constexpr(std::is_constructible_v<Target, Allocator const&>) {
+    return Target(allocator);
+  } else {
+    return Target();
+  }
+}
+
+template<typename T>
+inline constexpr bool is_pod_value{std::is_trivially_copyable_v<T> &&          // types sent with write_pod when serialised generically
+                                   !is_std_array<T>::value &&
+                                   !is_std_optional<T>::value &&
+                                   !is_std_variant<T>::value &&
+                                   !is_std_tuple<T>::value};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/// Helpers for buffers which are about to be completely overwritten by a
+/// read, so that large strings and blobs aren't filled with zeroes first
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace serialstorm {
+
+template<typename T, typename Allocator = std::allocator<T>>
+class default_init_allocator : public Allocator {
+  /// Allocator adaptor which default-initialises elements instead of
+  /// value-initialising them, so resizing a vector of trivial types, such as
+  /// std::vector<char, default_init_allocator<char>>, leaves the new elements
+  /// uninitialised rather than zeroing them
+  using traits = std::allocator_traits<Allocator>;
+
+public:
+  template<typename U>
+  struct rebind {
+    using other = default_init_allocator<U, typename traits::template rebind_alloc<U>>;
+  };
+
+  using Allocator::Allocator;
+
+  template<typename U>
+  inline void construct(U *ptr) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new(static_cast<void*>(ptr)) U;
+  }
+  template<typename U, typename... Args>
+  inline void construct(U *ptr, Args&&... args) {
+    traits::construct(static_cast<Allocator&>(*this), ptr, std::forward<Args>(args)...);
+  }
+};
+
+namespace detail {
+
+template<typename Function>
+inline bool fill_for_overwrite(Function &fill, char *data, size_t const size) {
+  /// Call a fill function which either returns nothing or reports success
+  if constexpr(std::is_void_v<std::invoke_result_t<Function&, char*, size_t>>) {
+    fill(data, size);
+    return true;
+  } else {
+    return static_cast<bool>(fill(data, size));
+  }
+}
+
+}
+
+template<typename StringT, typename Function>
+inline StringT make_string_for_overwrite(size_t const size, typename StringT::allocator_type const &allocator, Function &&fill) {
+  /// Make a string of the given size filled by calling fill(char *data,
+  /// size_t size), without initialising it first where the standard library
+  /// allows.  fill either returns nothing and throws on failure, or returns
+  /// false on failure, in which case the string is left empty.  Only release
+  /// builds on C++23 skip initialisation, through resize_and_overwrite; debug
+  /// builds fill with a marker and earlier standards with null bytes
+  #ifndef NDEBUG
+    StringT string(size, '?', allocator);                                       // use ? as a marker character to visibly show if we somehow end up with a short read
+    if(!detail::fill_for_overwrite(fill, string.data(), size)) {
+      string.clear();
+    }
+    return string;
+  #elif defined(__cpp_lib_string_resize_and_overwrite)
+    StringT string(allocator);
+    std::exception_ptr error;
+    string.resize_and_overwrite(size, [&](char *data, size_t) noexcept -> size_t {
+      /// Only the bytes reported here must be initialised, and this must not
+      /// throw, so a failed fill reports none and the error is passed on after.
+      /// Fill the size asked for rather than the size given, as libstdc++ 12
+      /// passes _M_create the requested size by reference when it reallocates,
+      /// so hands over the grown capacity instead (bits/basic_string.tcc)
+      try {
+        return detail::fill_for_overwrite(fill, data, size) ? size : 0;
+      } catch(...) {
+        error = std::current_exception();
+        return 0;
+      }
+    });
+    if(error) {
+      std::rethrow_exception(error);
+    }
+    return string;
+  #else
+    StringT string(size, '\0', allocator);                                      // no way to skip initialisation before C++23, so use null byte fill to minimise risk
+    if(!detail::fill_for_overwrite(fill, string.data(), size)) {
+      string.clear();
+    }
+    return string;
+  #endif
+}
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/// Varint codecs.  Every stream defaults to the original tagged format; the
+/// others can be selected per stream with set_varint_codec(), and both ends
+/// of a stream must agree on the codec used.
+///   TAGGED: values under 128 as one byte, anything else as a size tag byte
+///           followed by a uint8_t, uint16_t, uint32_t or uint64_t in the
+///           stream's byte order: 1, 2, 3, 5 or 9 bytes.
+///   LEB128: seven bits per byte, least significant group first, with the top
+///           bit of each byte set if another byte follows: 1 to 10 bytes.
+///   PREFIX: the number of bytes is given by the trailing zero bits of the
+///           first byte, so a decoder knows the size after one byte and can
+///           decode the rest without branching.  Seven bits of value per byte
+///           up to 56 bits, then a zero byte followed by all 64 bits: 1 to 9
+///           bytes.
+/// LEB128 and PREFIX are always little-endian, whatever the stream byte order.
+
+#include <cstddef>
+#include <cstdint>
+#include "endian.h"
+
+namespace serialstorm {
+
+enum class varint_codec : uint8_t {
+  TAGGED,                                                                       // the default, compatible with all previous versions
+  LEB128,
+  PREFIX
+};
+
+inline constexpr size_t varint_size_max{10};                                    // longest encoding of any codec, for LEB128
+
+inline constexpr unsigned int varint_bit_width(uint64_t const value) {
+  /// Report the number of bits needed to represent a value; zero for zero
+  #if defined(__GNUC__) || defined(__clang__)
+    return value == 0 ? 0 : 64 - static_cast<unsigned int>(__builtin_clzll(value));
+  #else
+    unsigned int width{0};
+    for(uint64_t remaining = value; remaining != 0; remaining >>= 1) {
+      ++width;
+    }
+    return width;
+  #endif
+}
+
+inline constexpr size_t varint_size_tagged(uint64_t const value) {
+  /// Report the number of bytes the tagged codec uses to encode a value
+  if(value < 0x80) {
+    return 1;
+  } else if(value <= UINT8_MAX) {
+    return 1 + sizeof(uint8_t);
+  } else if(value <= UINT16_MAX) {
+    return 1 + sizeof(uint16_t);
+  } else if(value <= UINT32_MAX) {
+    return 1 + sizeof(uint32_t);
+  }
+  return 1 + sizeof(uint64_t);
+}
+
+inline constexpr size_t varint_size_leb128(uint64_t const value) {
+  /// Report the number of bytes LEB128 uses to encode a value
+  unsigned int const width(varint_bit_width(value));
+  return width == 0 ? 1 : (width + 6) / 7;
+}
+
+inline constexpr size_t varint_size_prefix(uint64_t const value) {
+  /// Report the number of bytes the prefix codec uses to encode a value
+  unsigned int const width(varint_bit_width(value));
+  return width > 56 ? 9 : width == 0 ? 1 : (width + 6) / 7;
+}
+
+inline constexpr size_t encode_varint_tagged(uint64_t const value, uint8_t *bytes) {
+  /// Encode a value with the tagged codec into at least varint_size_max bytes,
+  /// returning the number used: the value itself if under 128, otherwise a
+  /// size tag of 0x80 to 0x83 for a uint8_t to uint64_t body in stream byte order
+  if(value < 0x80) {
+    bytes[0] = static_cast<uint8_t>(value);
+    return 1;
+  } else if(value <= UINT8_MAX) {
+    bytes[0] = 0x80;
+    bytes[1] = static_cast<uint8_t>(value);
+    return 1 + sizeof(uint8_t);
+  } else if(value <= UINT16_MAX) {
+    bytes[0] = 0x81;
+    encode_stream_order(static_cast<uint16_t>(value), bytes + 1);
+    return 1 + sizeof(uint16_t);
+  } else if(value <= UINT32_MAX) {
+    bytes[0] = 0x82;
+    encode_stream_order(static_cast<uint32_t>(value), bytes + 1);
+    return 1 + sizeof(uint32_t);
+  }
+  bytes[0] = 0x83;
+  encode_stream_order(value, bytes + 1);
+  return 1 + sizeof(uint64_t);
+}
+
+inline constexpr size_t encode_varint_leb128(uint64_t value, uint8_t *bytes) {
+  /// Encode a value as LEB128 into at least varint_size_max bytes, returning the number used
+  size_t size{0};
+  for(; value >= 0x80; value >>= 7) {
+    bytes[size++] = static_cast<uint8_t>(value | 0x80);
+  }
+  bytes[size++] = static_cast<uint8_t>(value);
+  return size;
+}
+
+inline constexpr size_t encode_varint_prefix(uint64_t const value, uint8_t *bytes) {
+  /// Encode a value with the prefix codec into at least varint_size_max bytes, returning the number used
+  size_t const size(varint_size_prefix(value));
+  if(size == 9) {
+    bytes[0] = 0;
+    for(size_t i = 0; i != 8; ++i) {
+      bytes[i + 1] = static_cast<uint8_t>(value >> (8 * i));
+    }
+  } else {
+    uint64_t const word(((value << 1) | 1) << (size - 1));                      // size - 1 zero bits, a one bit, then the value
+    for(size_t i = 0; i != size; ++i) {
+      bytes[i] = static_cast<uint8_t>(word >> (8 * i));
+    }
+  }
+  return size;
+}
+
+inline constexpr size_t varint_prefix_size_from_first(uint8_t const first) {
+  /// Report the total encoded size of a prefix varint from its first byte
+  #if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctz(static_cast<unsigned int>(first) | 0x100u)) + 1; // a zero first byte gives 9
+  #else
+    size_t size{1};
+    for(unsigned int bits = static_cast<unsigned int>(first) | 0x100u; !(bits & 1u); bits >>= 1) {
+      ++size;
+    }
+    return size;
+  #endif
+}
+
+inline constexpr uint64_t decode_varint_prefix(uint8_t const first, uint64_t const rest, size_t const size) {
+  /// Decode a prefix varint from its first byte, the remaining size - 1 bytes
+  /// assembled little-endian into an integer, and the size from the first byte
+  uint64_t const word(static_cast<uint64_t>(first) | (rest << 8));              // only used below 9 bytes, when rest holds at most 7 bytes
+  return size == 9 ? rest : word >> size;                                       // compiles to a conditional move, not a branch
+}
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+/// Multi-producer front-end for a stream shared between threads.  Producer
+/// threads serialise each message into a thread-local memory buffer and push
+/// the finished message onto a lock-free queue, without ever touching the
+/// stream or blocking on it.  A single sender thread drains the queue and
+/// writes the messages to the stream in batches with gather writes.  Whole
+/// messages are always written contiguously, never interleaved, and messages
+/// from any one producer are written in the order they were sent.  The sender
+/// can sleep until there is something to send, and if a write fails part way
+/// through a drain, the messages not yet written are kept for the next one.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "stream_memory.h"
+
+namespace serialstorm {
+
+class writer_queue {
+  struct message {
+    std::vector<char> data;
+    message *next{nullptr};
+  };
+  std::atomic<message*> head{nullptr};                                          // most recently pushed message; the queue is a lock-free stack in reverse order
+  std::vector<std::vector<char>> unsent;                                        // messages taken by a drain which failed before writing them, oldest first, only touched by the sender
+  size_t dropped_count{0};                                                      // messages in batches whose write failed, which may have been partly written
+
+  std::atomic<bool> sender_waiting{false};                                      // set while the sender sleeps in wait, so producers only lock to wake it when they must
+  std::mutex wait_mutex;
+  std::condition_variable wait_condition;
+  bool notified{false};                                                         // set by notify, guarded by wait_mutex
+
+public:
+  writer_queue() = default;
+  writer_queue(writer_queue const&) = delete;
+  writer_queue &operator=(writer_queue const&) = delete;
+
+  ~writer_queue() {
+    /// Discard any messages not yet sent
+    for(message *node = head.load(std::memory_order_acquire); node;) {
+      message *const next(node->next);
+      delete node;
+      node = next;
+    }
+  }
+
+  template<typename Function>
+  inline void send(Function &&encode) {
+    /// Serialise a message by calling encode(stream_memory<std::vector<char>>&)
+    /// on this thread, straight into the buffer that is queued for sending.
+    /// Safe to call from any number of threads at once, but encode must not
+    /// itself call send
+    thread_local size_t size_hint{0};                                           // the last message's size, so similar messages are allocated once rather than grown
+    std::unique_ptr<message> node(new message);
+    node->data.reserve(size_hint);
+    stream_memory<std::vector<char>> writer(node->data);
+    encode(writer);
+    size_hint = node->data.size();
+    push_node(node.release());
+  }
+
+  inline void push(std::vector<char> &&data) {
+    /// Queue an already serialised message for sending.  Safe to call from any
+    /// number of threads at once
+    push_node(new message{std::move(data)});
+  }
+
+  inline bool empty() const {
+    /// Report whether any messages are waiting to be sent, including any left
+    /// by a drain which failed.  Only exact on the sender thread
+    return head.load(std::memory_order_acquire) == nullptr && unsent.empty();
+  }
+
+  inline size_t dropped() const {
+    /// Report how many messages were lost in total because the write of their
+    /// batch failed, so they may have been sent in part or not at all.  Only
+    /// for use on the sender thread
+    return dropped_count;
+  }
+
+  inline void wait() {
+    /// Sleep on the sender thread until there is something to send, or until
+    /// notify is called
+    wait_until_ready([this](std::unique_lock<std::mutex> &lock, auto const &ready){
+      wait_condition.wait(lock, ready);
+    });
+  }
+  template<typename Rep, typename Period>
+  inline bool wait_for(std::chrono::duration<Rep, Period> const timeout) {
+    /// Sleep on the sender thread until there is something to send, notify is
+    /// called, or the timeout passes.  Returns whether there is anything to send
+    wait_until_ready([this, timeout](std::unique_lock<std::mutex> &lock, auto const &ready){
+      wait_condition.wait_for(lock, timeout, ready);
+    });
+    return !empty();
+  }
+
+  inline void notify() {
+    /// Wake the sender from wait even though nothing was queued, such as to
+    /// have it shut down.  Safe to call from any thread
+    {
+      std::lock_guard<std::mutex> const lock(wait_mutex);
+      notified = true;
+    }
+    wait_condition.notify_one();
+  }
+
+  template<typename StreamT>
+  inline size_t drain(StreamT &stream, size_t const batch_max = 0) {
+    /// Write all queued messages to the stream in the order they were queued,
+    /// with one gather write per batch of up to batch_max messages (0 for no
+    /// limit).  Returns the number of messages written.  Must only be called
+    /// from one thread at a time.  If a write throws, the messages in its
+    /// batch are counted by dropped(), and those after it are kept to be
+    /// written first by the next drain
+    message *node(head.exchange(nullptr, std::memory_order_acquire));           // take the whole queue at once, leaving producers a fresh empty one
+    size_t const taken_start(unsent.size());                                    // anything left by a failed drain goes first
+    for(; node;) {                                                              // unlink into a vector first so nothing leaks if the write throws
+      message *const next(node->next);
+      unsent.emplace_back(std::move(node->data));
+      delete node;
+      node = next;
+    }
+    std::reverse(unsent.begin() + static_cast<std::ptrdiff_t>(taken_start), unsent.end()); // newest first on the stack, so reverse to send oldest first
+    size_t const message_count(unsent.size());
+    std::vector<std::string_view> batch;
+    batch.reserve(batch_max == 0 ? message_count : std::min(batch_max, message_count));
+    size_t written{0};
+    try {
+      for(size_t i = 0; i != message_count; ++i) {
+        batch.emplace_back(unsent[i].data(), unsent[i].size());
+        if(batch.size() == batch_max || i + 1 == message_count) {
+          stream.write_gather(batch);
+          written += batch.size();
+          batch.clear();
+        }
+      }
+    } catch(...) {
+      dropped_count += batch.size();
+      unsent.erase(unsent.begin(), unsent.begin() + static_cast<std::ptrdiff_t>(written + batch.size()));
+      throw;
+    }
+    unsent.clear();
+    return message_count;
+  }
+
+private:
+  inline void push_node(message *const node) {
+    /// Push a message onto the queue, and wake the sender if it is asleep
+    node->next = head.load(std::memory_order_relaxed);
+    while(!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+      // node->next has been updated to the current head, try again
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);                        // pairs with the fence in wait_until_ready, so either we see the sender waiting or it sees our message
+    if(sender_waiting.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> const lock(wait_mutex);                       // the sender holds this until it sleeps, so the wake can't come between its check and its sleep
+      wait_condition.notify_one();
+    }
+  }
+
+  template<typename WaitFunction>
+  inline void wait_until_ready(WaitFunction &&wait_function) {
+    /// Sleep with wait_function(lock, ready) until there is something to send or notify is called
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    sender_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);                        // pairs with the fence in push_node
+    auto const ready([this]{
+      return notified || !empty();
+    });
+    wait_function(lock, ready);
+    sender_waiting.store(false, std::memory_order_relaxed);
+    notified = false;
+  }
+};
+
+}
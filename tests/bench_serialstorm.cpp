@@ -0,0 +1,246 @@
+/// Throughput benchmarks for serialstorm, built when SERIALSTORM_BENCHMARK is
+/// enabled and run by hand rather than by ctest.  Build in release mode for
+/// meaningful numbers.  Reads go through stream_memory so that the cost of
+/// the serialisation paths themselves is measured rather than a device, apart
+/// from the std::stringstream pods which measure the std stream wrapper.
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "serialstorm/columns.h"
+#include "serialstorm/stream_memory.h"
+#include "serialstorm/stream_std_stream.h"
+
+namespace {
+
+using writer_t = serialstorm::stream_memory<std::vector<char>>;
+using reader_t = serialstorm::stream_memory<std::string_view>;
+
+class null_buffer : public std::streambuf {
+  /// Stream buffer which discards everything written to it
+protected:
+  std::streamsize xsputn(char const*, std::streamsize const count) override {
+    return count;
+  }
+  int_type overflow(int_type const c) override {
+    return traits_type::not_eof(c);
+  }
+};
+
+struct entity_state {                                                           // a typical game state snapshot, for the columnar batch comparison
+  uint32_t id;
+  uint32_t tick;
+  int16_t health;
+  std::array<float, 3> position;
+};
+
+template<typename Function>
+void report(char const *name, size_t const bytes, unsigned int const iterations, Function &&function) {
+  /// Time the best of several runs of many iterations of function, and report its throughput
+  constexpr unsigned int runs{5};
+  double best_seconds{0};
+  for(unsigned int run = 0; run != runs; ++run) {
+    auto const start(std::chrono::steady_clock::now());
+    for(unsigned int i = 0; i != iterations; ++i) {
+      function();
+    }
+    double const seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if(run == 0 || seconds < best_seconds) {
+      best_seconds = seconds;
+    }
+  }
+  std::printf("%-48s %10.1f MiB/s\n", name, static_cast<double>(bytes) * iterations / (1024.0 * 1024.0) / best_seconds);
+}
+
+template<typename Function>
+double best_seconds_of(unsigned int const iterations, Function &&function) {
+  /// Time the best of several runs of many iterations of function
+  constexpr unsigned int runs{5};
+  double best_seconds{0};
+  for(unsigned int run = 0; run != runs; ++run) {
+    auto const start(std::chrono::steady_clock::now());
+    for(unsigned int i = 0; i != iterations; ++i) {
+      function();
+    }
+    double const seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if(run == 0 || seconds < best_seconds) {
+      best_seconds = seconds;
+    }
+  }
+  return best_seconds;
+}
+
+void report_varints(char const *name, serialstorm::varint_codec const codec, std::vector<uint64_t> const &values) {
+  /// Report the encoded size and encode and decode rates of a set of varints with one codec
+  constexpr unsigned int iterations{16};
+  std::vector<char> encoded;
+  double const encode_seconds(best_seconds_of(iterations, [&]{
+    encoded.clear();
+    writer_t writer(encoded);
+    writer.set_varint_codec(codec);
+    for(auto const value : values) {
+      writer.write_varint(value);
+    }
+  }));
+  uint64_t checksum{0};
+  double const decode_seconds(best_seconds_of(iterations, [&]{
+    std::string_view view(encoded.data(), encoded.size());
+    reader_t reader(view);
+    reader.set_varint_codec(codec);
+    for(size_t i = 0; i != values.size(); ++i) {
+      checksum += reader.read_varint<uint64_t>();
+    }
+  }));
+  double const count(static_cast<double>(values.size()) * iterations / 1e6);
+  std::printf("%-24s %8.3f bytes each, encode %8.1f M/s, decode %8.1f M/s  (%llu)\n",
+              name,
+              static_cast<double>(encoded.size()) / static_cast<double>(values.size()),
+              count / encode_seconds,
+              count / decode_seconds,
+              static_cast<unsigned long long>(checksum & 1));
+}
+
+}
+
+int main() {
+  constexpr size_t blob_size{4 * 1024 * 1024};                                  // large enough to matter, small enough for the allocator to reuse memory between iterations
+  constexpr unsigned int iterations{256};
+
+  std::vector<char> encoded;
+  {
+    writer_t writer(encoded);
+    std::string const payload(blob_size, 'x');
+    writer.write_varstring(payload);
+    writer.write_blob(std::vector<char>(payload.begin(), payload.end()));
+    writer.write_blob(std::vector<char>(payload.begin(), payload.end()));
+    writer.write_varblob(std::vector<char>(payload.begin(), payload.end()));
+  }
+  std::string_view const view(encoded.data(), encoded.size());
+  size_t const string_end(1 + 4 + blob_size);                                   // varint length prefix is a size byte and a uint32_t at this size
+  size_t const blob_end(string_end + blob_size);
+  size_t const blob_default_init_end(blob_end + blob_size);
+
+  report("read_varstring", blob_size, iterations, [&]{
+    std::string_view string_view(view.substr(0, string_end));
+    reader_t reader(string_view);
+    std::string const string(reader.read_varstring());
+    if(string.size() != blob_size) {
+      std::printf("size mismatch\n");
+    }
+  });
+  report("read_blob, std::allocator", blob_size, iterations, [&]{
+    std::string_view blob_view(view.substr(string_end, blob_end - string_end));
+    reader_t reader(blob_view);
+    auto const blob(reader.read_blob<char>(blob_size));
+    if(blob.size() != blob_size) {
+      std::printf("size mismatch\n");
+    }
+  });
+  report("read_blob, default_init_allocator", blob_size, iterations, [&]{
+    std::string_view blob_view(view.substr(blob_end, blob_default_init_end - blob_end));
+    reader_t reader(blob_view);
+    auto const blob(reader.read_blob<char, size_t, serialstorm::default_init_allocator<char>>(blob_size));
+    if(blob.size() != blob_size) {
+      std::printf("size mismatch\n");
+    }
+  });
+  report("read_varblob to a discarding ostream", blob_size, iterations, [&]{
+    std::string_view varblob_view(view.substr(blob_default_init_end));
+    reader_t reader(varblob_view);
+    null_buffer buffer;
+    std::ostream outstream(&buffer);
+    reader.read_varblob(outstream);
+  });
+
+  constexpr size_t pod_count{1 << 20};                                          // small pods through a std::stringstream, dominated by per-call overhead
+  std::stringstream pod_stream;
+  report("write_pod<uint32_t> to a std::stringstream", pod_count * sizeof(uint32_t), 16, [&]{
+    pod_stream.str({});
+    serialstorm::stream_std_stream<std::stringstream> writer(pod_stream);
+    for(size_t i = 0; i != pod_count; ++i) {
+      writer.write_pod(static_cast<uint32_t>(i));
+    }
+  });
+  report("read_pod<uint32_t> from a std::stringstream", pod_count * sizeof(uint32_t), 16, [&]{
+    pod_stream.clear();
+    pod_stream.seekg(0);
+    serialstorm::stream_std_stream<std::stringstream> reader(pod_stream);
+    uint32_t checksum{0};
+    for(size_t i = 0; i != pod_count; ++i) {
+      checksum += reader.read_pod<uint32_t>();
+    }
+    if(checksum != static_cast<uint32_t>(pod_count * (pod_count - 1) / 2)) {
+      std::printf("checksum mismatch\n");
+    }
+  });
+
+  std::mt19937_64 random(1);
+  std::vector<uint64_t> small_values(1 << 20);                                  // counts and lengths, mostly between 100 and 300
+  for(auto &value : small_values) {
+    value = std::uniform_int_distribution<uint64_t>(0, 400)(random);
+  }
+  std::vector<uint64_t> mixed_values(1 << 20);                                  // ids and sizes spread over every magnitude
+  for(auto &value : mixed_values) {
+    value = random() >> std::uniform_int_distribution<unsigned int>(0, 63)(random);
+  }
+  for(auto const &[values, label] : {std::pair{&small_values, "0-400"}, std::pair{&mixed_values, "mixed magnitudes"}}) {
+    std::printf("\nvarints, %s:\n", label);
+    report_varints("  tagged", serialstorm::varint_codec::TAGGED, *values);
+    report_varints("  leb128", serialstorm::varint_codec::LEB128, *values);
+    report_varints("  prefix", serialstorm::varint_codec::PREFIX, *values);
+  }
+
+  std::vector<entity_state> entities(1 << 16);                                  // sorted ids, one tick, health in a small range
+  for(size_t i = 0; i != entities.size(); ++i) {
+    entities[i] = entity_state{static_cast<uint32_t>(1000 + i * 2), 123456, static_cast<int16_t>(random() % 200), {static_cast<float>(i), 0.0f, 1.0f}};
+  }
+  using entity_batch = serialstorm::columns<serialstorm::column<&entity_state::id, serialstorm::column_encoding::DELTA>,
+                                            serialstorm::column<&entity_state::tick, serialstorm::column_encoding::DELTA>,
+                                            serialstorm::column<&entity_state::health>,
+                                            serialstorm::column<&entity_state::position>>;
+  std::vector<char> rows;
+  {
+    writer_t writer(rows);
+    writer.write_varint(entities.size());
+    for(auto const &entity : entities) {
+      writer.write_varint(entity.id);
+      writer.write_varint(entity.tick);
+      writer.write_pod(entity.health);
+      writer.write_pod(entity.position);
+    }
+  }
+  std::vector<char> batch;
+  {
+    writer_t writer(batch);
+    entity_batch::write(writer, entities);
+  }
+  std::printf("\nentity snapshots, %zu records: %zu bytes as rows, %zu as columns\n", entities.size(), rows.size(), batch.size());
+  std::vector<entity_state> received;
+  report("  read as rows", entities.size() * sizeof(entity_state), 64, [&]{
+    std::string_view rows_view(rows.data(), rows.size());
+    reader_t reader(rows_view);
+    received.resize(reader.read_varint<size_t>());
+    for(auto &entity : received) {
+      entity.id = reader.read_varint<uint32_t>();
+      entity.tick = reader.read_varint<uint32_t>();
+      entity.health = reader.read_pod<int16_t>();
+      entity.position = reader.read_pod<std::array<float, 3>>();
+    }
+  });
+  report("  read as columns", entities.size() * sizeof(entity_state), 64, [&]{
+    std::string_view batch_view(batch.data(), batch.size());
+    reader_t reader(batch_view);
+    entity_batch::read_into(reader, received);
+  });
+  return 0;
+}
@@ -0,0 +1,221 @@
+/// libFuzzer harness for the serialstorm read paths, built when SERIALSTORM_FUZZ
+/// is enabled.  Each input is decoded as a stream of operations: a byte to
+/// choose the operation, followed by whatever that operation reads, so the
+/// fuzzer is free to reach every read primitive in any order and with any
+/// lengths.  The stream is given a decode budget of the input size and a small
+/// allocation limit, so a hostile length must be rejected before anything is
+/// allocated for it.  Malformed input must only ever be reported by throwing
+/// std::runtime_error or returning an errc; anything else is a bug.
+///
+/// Without a compiler that supports libFuzzer, define
+/// SERIALSTORM_FUZZ_STANDALONE to build a driver that replays the inputs
+/// named on the command line instead, for reproducing crashes and regression
+/// testing a corpus.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#ifdef SERIALSTORM_FUZZ_STANDALONE
+  #include <fstream>
+  #include <iostream>
+  #include <iterator>
+#endif // SERIALSTORM_FUZZ_STANDALONE
+
+#include "serialstorm/bit_stream.h"
+#include "serialstorm/columns.h"
+#include "serialstorm/parallel.h"
+#include "serialstorm/record.h"
+#include "serialstorm/stream_memory.h"
+
+namespace {
+
+using reader_t = serialstorm::stream_memory<std::string_view>;
+
+constexpr size_t allocation_max{64 * 1024};                                     // far larger than any input the fuzzer will try, so only hostile lengths hit it
+
+struct fuzz_entity {
+  /// A struct with a field or column of every kind, for the record and batch readers
+  uint32_t id;
+  int16_t health;
+  float weight;
+  std::string name;
+  std::optional<std::vector<uint16_t>> scores;
+};
+
+using fuzz_entity_record = serialstorm::record<serialstorm::field<1, &fuzz_entity::id>,
+                                               serialstorm::field<2, &fuzz_entity::health>,
+                                               serialstorm::field<3, &fuzz_entity::weight>,
+                                               serialstorm::field<5, &fuzz_entity::name>,
+                                               serialstorm::field<7, &fuzz_entity::scores>>;
+using fuzz_entity_batch = serialstorm::columns<serialstorm::column<&fuzz_entity::id, serialstorm::column_encoding::DELTA>,
+                                               serialstorm::column<&fuzz_entity::health>,
+                                               serialstorm::column<&fuzz_entity::weight>,
+                                               serialstorm::column<&fuzz_entity::name>,
+                                               serialstorm::column<&fuzz_entity::scores>>;
+
+class null_buffer : public std::streambuf {
+  /// Stream buffer which discards everything written to it
+protected:
+  std::streamsize xsputn(char const*, std::streamsize const count) override {
+    return count;
+  }
+  int_type overflow(int_type const c) override {
+    return traits_type::not_eof(c);
+  }
+};
+
+void decode_throwing(std::string_view data) {
+  /// Decode the input with the throwing read functions until it runs out
+  reader_t reader(data);
+  reader.set_read_budget(data.size());
+  reader.set_allocation_max(allocation_max);
+  null_buffer buffer;
+  std::ostream outstream(&buffer);
+  serialstorm::string_dictionary_reader dictionary(16);
+  reader.set_varint_codec(static_cast<serialstorm::varint_codec>(reader.read_pod<uint8_t>() % 3));
+  while(reader.remaining() != 0) {
+    switch(reader.read_pod<uint8_t>() % 18) {
+    case 0:
+      reader.read_pod<uint64_t>();
+      break;
+    case 1:
+      reader.read_varint<uint64_t>();
+      break;
+    case 2:
+      reader.read_varstring();
+      break;
+    case 3:
+      reader.read_varstring_fixed<uint32_t>();
+      break;
+    case 4:
+      reader.read_varblob(outstream, 0, 256);                                   // a small buffer, so long blobs take several fills
+      break;
+    case 5:
+      reader.read_value<std::vector<uint32_t>>();
+      break;
+    case 6:
+      reader.read_value<std::vector<std::string>>();
+      break;
+    case 7:
+      reader.read_value<std::map<std::string, std::vector<uint16_t>>>();
+      break;
+    case 8:
+      reader.read_value<std::unordered_map<uint32_t, std::string>>();
+      break;
+    case 9:
+      reader.read_value<std::optional<std::string>>();
+      break;
+    case 10:
+      reader.read_value<std::variant<uint8_t, std::string, std::vector<uint64_t>>>();
+      break;
+    case 11:
+      reader.read_value<std::tuple<uint16_t, std::string, std::array<uint8_t, 3>>>();
+      break;
+    case 12:
+      reader.read_value<std::vector<std::tuple<>>>();                           // elements with an empty encoding, bounded only by the allocation limit
+      break;
+    case 13:
+      reader.read_varstring_interned(dictionary);
+      break;
+    case 14: {
+      serialstorm::bit_reader bits(reader);
+      unsigned int const bit_count(reader.read_pod<uint8_t>() % 65u);
+      bits.read_bits(bit_count);
+      bits.read_bool();
+      bits.align();
+      break;
+    }
+    case 15:
+      serialstorm::read_chunks_parallel(reader, [](size_t, serialstorm::chunk_reader &chunk){
+        while(chunk.remaining() != 0) {
+          chunk.read_varstring();
+        }
+      }, 0, 0, 1);
+      break;
+    case 16:
+      fuzz_entity_record::read(reader, 256);
+      break;
+    case 17:
+      fuzz_entity_batch::read(reader, 256);
+      break;
+    }
+  }
+}
+
+void decode_non_throwing(std::string_view data) {
+  /// Decode the input with the non-throwing read functions until it runs out or reports an error
+  reader_t reader(data);
+  reader.set_read_budget(data.size());
+  reader.set_allocation_max(allocation_max);
+  null_buffer buffer;
+  std::ostream outstream(&buffer);
+  auto const codec(reader.try_read_pod<uint8_t>());
+  if(!codec) {
+    return;
+  }
+  reader.set_varint_codec(static_cast<serialstorm::varint_codec>(*codec % 3));
+  for(;;) {
+    auto const operation(reader.try_read_pod<uint8_t>());
+    if(!operation) {
+      return;
+    }
+    serialstorm::errc error{serialstorm::errc::NONE};
+    switch(*operation % 5) {
+    case 0:
+      error = reader.try_read_pod<uint64_t>().error();
+      break;
+    case 1:
+      error = reader.try_read_varint<uint64_t>().error();
+      break;
+    case 2:
+      error = reader.try_read_varstring().error();
+      break;
+    case 3:
+      error = reader.try_read_varstring_fixed<uint32_t>().error();
+      break;
+    case 4:
+      error = reader.try_read_varblob(outstream, 0, 256);
+      break;
+    }
+    if(error != serialstorm::errc::NONE) {
+      return;
+    }
+  }
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const *data, size_t const size) {
+  std::string_view const input(reinterpret_cast<char const*>(data), size);
+  try {
+    decode_throwing(input);
+  } catch(std::runtime_error const&) {
+    // malformed input, reported as it should be
+  }
+  decode_non_throwing(input);
+  return 0;
+}
+
+#ifdef SERIALSTORM_FUZZ_STANDALONE
+  int main(int argc, char *argv[]) {
+    /// Replay each input file named on the command line through the harness
+    for(int i = 1; i != argc; ++i) {
+      std::ifstream file(argv[i], std::ios::binary);
+      std::string const input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      LLVMFuzzerTestOneInput(reinterpret_cast<uint8_t const*>(input.data()), input.size());
+      std::cout << "SerialStorm: replayed " << argv[i] << " (" << input.size() << " bytes)" << std::endl;
+    }
+    return 0;
+  }
+#endif // SERIALSTORM_FUZZ_STANDALONE
@@ -0,0 +1,149 @@
+/// Tests for explicit wire byte order.
+/// Built as a separate executable because SERIALSTORM_BYTE_ORDER must be
+/// defined before any SerialStorm header is included.  The wire order chosen
+/// here is the opposite of the host's, so every swapping path is exercised.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  #define SERIALSTORM_BYTE_ORDER LITTLE
+#else
+  #define SERIALSTORM_BYTE_ORDER BIG
+#endif
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "serialstorm/stream_std_stream.h"
+
+using stream_t = serialstorm::stream_std_stream<std::stringstream>;
+
+static std::vector<uint8_t> bytes_of(std::stringstream const &ss) {
+  std::string const raw(ss.str());
+  return std::vector<uint8_t>(raw.begin(), raw.end());
+}
+
+static bool wire_is_big_endian() {
+  return serialstorm::stream_byte_order == serialstorm::byte_order::BIG;
+}
+
+TEST_CASE("pods are written in the configured byte order", "[endian]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<uint32_t>(0x01020304u);
+  std::vector<uint8_t> const expected(wire_is_big_endian() ? std::vector<uint8_t>{1, 2, 3, 4} : std::vector<uint8_t>{4, 3, 2, 1});
+  CHECK(bytes_of(ss) == expected);
+  ss.seekg(0);
+  CHECK(s.read_pod<uint32_t>() == 0x01020304u);
+}
+
+TEST_CASE("pods of every swappable type round-trip", "[endian]") {
+  enum class small_enum : uint16_t { VALUE = 0x1234 };
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<int16_t>(-2);
+  s.write_pod<uint64_t>(0x0102030405060708ULL);
+  s.write_pod<float>(1.5f);
+  s.write_pod<double>(-1234.5678);
+  s.write_pod(small_enum::VALUE);
+  s.write_pod<uint8_t>(0xAB);
+  ss.seekg(0);
+  CHECK(s.read_pod<int16_t>() == -2);
+  CHECK(s.read_pod<uint64_t>() == 0x0102030405060708ULL);
+  CHECK(s.read_pod<float>() == 1.5f);
+  CHECK(s.read_pod<double>() == -1234.5678);
+  CHECK(s.read_pod<small_enum>() == small_enum::VALUE);
+  CHECK(s.read_pod<uint8_t>() == 0xAB);
+}
+
+TEST_CASE("varint bodies are written in the configured byte order", "[endian]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_varint<uint64_t>(0x0102u);
+  std::vector<uint8_t> const expected(wire_is_big_endian() ? std::vector<uint8_t>{0x81, 1, 2} : std::vector<uint8_t>{0x81, 2, 1});
+  CHECK(bytes_of(ss) == expected);
+  ss.seekg(0);
+  CHECK(s.read_varint<uint64_t>() == 0x0102u);
+  CHECK(s.tellp() == 3);
+}
+
+TEST_CASE("try_read_pod applies the configured byte order", "[endian]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<uint32_t>(0xCAFEBABEu);
+  s.write_varint<uint64_t>(70000u);
+  ss.seekg(0);
+  CHECK(s.try_read_pod<uint32_t>().value() == 0xCAFEBABEu);
+  CHECK(s.try_read_varint<uint64_t>().value() == 70000u);
+}
+
+TEST_CASE("pod arrays are byte swapped in bulk", "[endian]") {
+  SECTION("uint16_t, with a scalar tail") {
+    std::vector<uint16_t> input(37);
+    std::iota(input.begin(), input.end(), uint16_t{0x0100});
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod_array(input.data(), input.size());
+    auto const raw(bytes_of(ss));
+    REQUIRE(raw.size() == input.size() * 2);
+    CHECK(raw[0] == (wire_is_big_endian() ? 0x01 : 0x00));
+    ss.seekg(0);
+    std::vector<uint16_t> output(input.size());
+    s.read_pod_array(output.data(), output.size());
+    CHECK(output == input);
+  }
+  SECTION("uint32_t, larger than one swap block") {
+    std::vector<uint32_t> input(5000);
+    std::iota(input.begin(), input.end(), 0x01000000u);
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod_array(input.data(), input.size());
+    std::stringstream expected_ss;
+    stream_t expected_s(expected_ss);
+    for(auto const value : input) {
+      expected_s.write_pod(value);
+    }
+    CHECK(ss.str() == expected_ss.str());
+    ss.seekg(0);
+    std::vector<uint32_t> output(input.size());
+    s.read_pod_array(output.data(), output.size());
+    CHECK(output == input);
+  }
+  SECTION("double") {
+    std::vector<double> const input{1.0, -2.5, 3.25, 1e300, -0.0};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod_array(input.data(), input.size());
+    ss.seekg(0);
+    std::vector<double> output(input.size());
+    s.read_pod_array(output.data(), output.size());
+    CHECK(std::memcmp(output.data(), input.data(), input.size() * sizeof(double)) == 0);
+  }
+}
+
+TEST_CASE("byte_swap reverses bytes", "[endian]") {
+  CHECK(serialstorm::byte_swap<uint16_t>(0x0102) == 0x0201);
+  CHECK(serialstorm::byte_swap<uint32_t>(0x01020304u) == 0x04030201u);
+  CHECK(serialstorm::byte_swap<uint64_t>(0x0102030405060708ULL) == 0x0807060504030201ULL);
+  CHECK(serialstorm::byte_swap(serialstorm::byte_swap(-1.25)) == -1.25);
+}
+
+TEST_CASE("vectors of pods are byte swapped in bulk", "[endian][container]") {
+  std::vector<uint32_t> const input = {1, 0x01020304u, 0xFFFFFFFFu};
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_vector(input);
+  std::stringstream expected_ss;
+  stream_t expected_s(expected_ss);
+  expected_s.write_varint(input.size());
+  for(auto const value : input) {
+    expected_s.write_pod(value);
+  }
+  CHECK(ss.str() == expected_ss.str());
+  ss.seekg(0);
+  CHECK(s.read_vector<uint32_t>() == input);
+}
@@ -6,16 +6,46 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/catch_approx.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <limits>
+#include <map>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <variant>
 #include <vector>
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+#endif // _WIN32
 
 // Include only the std::stream adapter – avoids a Boost dependency in tests.
 #include "serialstorm/stream_std_stream.h"
+#include "serialstorm/bit_stream.h"
+#include "serialstorm/stream_memory.h"
+#include "serialstorm/parallel.h"
+#include "serialstorm/writer_queue.h"
+#include "serialstorm/shared_message.h"
+#include "serialstorm/static_message.h"
+#include "serialstorm/record.h"
+#include "serialstorm/columns.h"
+#include "serialstorm/stream_shm_ring.h"
+#include "serialstorm/stream_datagram.h"
 
 using stream_t = serialstorm::stream_std_stream<std::stringstream>;
 
@@ -127,6 +157,20 @@ TEST_CASE("write_pod / read_pod preserves byte-exact representation", "[pod]") {
   CHECK(reconstructed == original);
 }
 
+TEST_CASE("write_pod_array / read_pod_array round-trip in native byte order", "[pod]") {
+  std::vector<uint32_t> const input = {1, 2, 0xFFFFFFFFu, 0x12345678u};
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod_array(input.data(), input.size());
+  CHECK(ss.str().size() == input.size() * sizeof(uint32_t));
+  CHECK(std::memcmp(ss.str().data(), input.data(), ss.str().size()) == 0);
+  reset_for_read(ss);
+  std::vector<uint32_t> output(input.size());
+  s.read_pod_array(output.data(), output.size());
+  CHECK(output == input);
+  CHECK(s.tellp() == 16);
+}
+
 // ============================================================================
 // Buffer read / write
 // ============================================================================
@@ -164,6 +208,119 @@ TEST_CASE("write_buffer / read_buffer with raw byte arrays", "[buffer]") {
   }
 }
 
+namespace {
+
+class small_window_buffer : public std::streambuf {
+  /// Stream buffer over a string with get and put areas only a few bytes
+  /// long, so reads and writes keep straddling the end of the buffered data
+  std::string &data;
+  size_t read_offset{0};
+  char get_area[3];
+  char put_area[4];
+
+public:
+  explicit small_window_buffer(std::string &this_data)
+    : data(this_data) {
+    setp(put_area, put_area + sizeof(put_area));
+  }
+
+protected:
+  int_type underflow() override {
+    size_t const count(std::min(sizeof(get_area), data.size() - read_offset));
+    if(count == 0) {
+      return traits_type::eof();
+    }
+    std::memcpy(get_area, data.data() + read_offset, count);
+    read_offset += count;
+    setg(get_area, get_area, get_area + count);
+    return traits_type::to_int_type(get_area[0]);
+  }
+  int_type overflow(int_type const c) override {
+    sync();
+    if(!traits_type::eq_int_type(c, traits_type::eof())) {
+      data.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+  int sync() override {
+    data.append(pbase(), static_cast<size_t>(pptr() - pbase()));
+    setp(put_area, put_area + sizeof(put_area));
+    return 0;
+  }
+};
+
+}
+
+TEST_CASE("stream_std_stream reads and writes straddle the stream buffer and keep its state", "[buffer]") {
+  SECTION("values round-trip through small get and put areas") {
+    std::string data;
+    small_window_buffer buffer(data);
+    std::iostream stream(&buffer);
+    serialstorm::stream_std_stream<std::iostream> s(stream);
+    for(uint16_t i = 0; i != 100; ++i) {
+      s.write_pod<uint8_t>(static_cast<uint8_t>(i));
+      s.write_pod<uint16_t>(i);
+      s.write_varstring(std::string(i % 7, 'x'));
+    }
+    stream.flush();
+    for(uint16_t i = 0; i != 100; ++i) {
+      CHECK(s.read_pod<uint8_t>() == static_cast<uint8_t>(i));
+      CHECK(s.read_pod<uint16_t>() == i);
+      CHECK(s.read_varstring() == std::string(i % 7, 'x'));
+    }
+    CHECK(s.try_read_pod<uint8_t>().error() == serialstorm::errc::SHORT_READ);
+    CHECK(stream.eof());
+    CHECK(stream.fail());
+  }
+  SECTION("a failed stream reads and writes nothing, even with data buffered") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod<uint32_t>(1);
+    s.write_pod<uint32_t>(2);
+    reset_for_read(ss);
+    CHECK(s.read_pod<uint32_t>() == 1);
+    ss.setstate(std::ios_base::failbit);
+    CHECK(s.try_read_pod<uint32_t>().error() == serialstorm::errc::SHORT_READ);
+    s.write_pod<uint32_t>(3);
+    ss.clear();
+    CHECK(s.read_pod<uint32_t>() == 2);
+    CHECK(s.try_read_pod<uint8_t>().error() == serialstorm::errc::SHORT_READ);
+  }
+  SECTION("a short read leaves the rest of the buffered data consumed") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod<uint16_t>(7);
+    reset_for_read(ss);
+    CHECK(s.try_read_pod<uint32_t>().error() == serialstorm::errc::SHORT_READ);
+    CHECK(ss.eof());
+    CHECK(ss.rdbuf()->in_avail() <= 0);
+  }
+  SECTION("skipping seeks through a file, but never past its end") {
+    std::string const path((std::filesystem::temp_directory_path() / "serialstorm_skip_test.bin").string());
+    {
+      std::ofstream file(path, std::ios::binary);
+      serialstorm::stream_std_stream<std::ofstream> writer(file);
+      for(uint32_t i = 0; i != 4096; ++i) {                                     // larger than the file buffer, so skipping has to seek
+        writer.write_pod<uint32_t>(i);
+      }
+    }
+    std::ifstream file(path, std::ios::binary);
+    serialstorm::stream_std_stream<std::ifstream> reader(file);
+    reader.skip(4);
+    CHECK(reader.read_pod<uint32_t>() == 1);
+    reader.skip(4 * 4093);
+    CHECK(reader.read_pod<uint32_t>() == 4095);
+    #ifdef NDEBUG
+      reader.skip(100);
+    #else
+      CHECK_THROWS_AS(reader.skip(100), std::runtime_error);
+    #endif
+    CHECK(reader.try_read_pod<uint8_t>().error() == serialstorm::errc::SHORT_READ);
+    file.close();
+    std::filesystem::remove(path);
+  }
+}
+
 // ============================================================================
 // VarInt encoding / decoding
 // ============================================================================
@@ -242,6 +399,70 @@ TEST_CASE("read_varint throws std::runtime_error on unknown size byte", "[varint
   }
 }
 
+TEST_CASE("read_varint / write_varint round-trip with each varint codec", "[varint][codec]") {
+  std::vector<uint64_t> const values{
+    0, 1, 127, 128, 255, 256, 16383, 16384, 65535, 65536, (uint64_t{1} << 21) - 1, uint64_t{1} << 21,
+    0xFFFFFFFFu, uint64_t{1} << 32, (uint64_t{1} << 56) - 1, uint64_t{1} << 56, uint64_t{1} << 63,
+    std::numeric_limits<uint64_t>::max()
+  };
+  for(auto const codec : {serialstorm::varint_codec::TAGGED, serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX}) {
+    CAPTURE(static_cast<int>(codec));
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_varint_codec(codec);
+    CHECK(s.get_varint_codec() == codec);
+    for(auto const value : values) {
+      CAPTURE(value);
+      size_t const position(s.tellw());
+      s.write_varint(value);
+      size_t const expected(codec == serialstorm::varint_codec::TAGGED ? serialstorm::varint_size_tagged(value) :
+                            codec == serialstorm::varint_codec::LEB128 ? serialstorm::varint_size_leb128(value) :
+                                                                         serialstorm::varint_size_prefix(value));
+      CHECK(s.tellw() - position == expected);
+    }
+    s.write_varstring("tail");
+
+    reset_for_read(ss);
+    for(auto const value : values) {
+      CHECK(s.read_varint<uint64_t>() == value);
+    }
+    CHECK(s.read_varstring() == "tail");
+
+    reset_for_read(ss);
+    for(auto const value : values) {
+      auto const result(s.try_read_varint<uint64_t>());
+      REQUIRE(result.has_value());
+      CHECK(*result == value);
+    }
+  }
+}
+
+TEST_CASE("LEB128 and prefix varints have the documented little-endian wire format", "[varint][codec]") {
+  auto const encode([](serialstorm::varint_codec const codec, uint64_t const value) {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_varint_codec(codec);
+    s.write_varint(value);
+    return ss.str();
+  });
+  CHECK(encode(serialstorm::varint_codec::LEB128, 300) == std::string("\xAC\x02", 2));
+  CHECK(encode(serialstorm::varint_codec::LEB128, 200) == std::string("\xC8\x01", 2));
+  CHECK(encode(serialstorm::varint_codec::PREFIX, 5) == std::string("\x0B", 1));
+  CHECK(encode(serialstorm::varint_codec::PREFIX, 300) == std::string("\xB2\x04", 2));    // 300 << 2 | 0b10
+  CHECK(encode(serialstorm::varint_codec::PREFIX, std::numeric_limits<uint64_t>::max()) == std::string(1, '\0') + std::string(8, '\xFF'));
+}
+
+TEST_CASE("over-long LEB128 varints are rejected", "[varint][codec][error]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.set_varint_codec(serialstorm::varint_codec::LEB128);
+  ss << std::string(9, '\xFF') << '\x02';                                      // a 65th bit
+  reset_for_read(ss);
+  CHECK_THROWS_AS(s.read_varint<uint64_t>(), std::runtime_error);
+  reset_for_read(ss);
+  CHECK(s.try_read_varint<uint64_t>().error() == serialstorm::errc::BAD_VARINT_SIZE);
+}
+
 // ============================================================================
 // String read / write
 // ============================================================================
@@ -367,6 +588,63 @@ TEST_CASE("write_varstring_fixed / read_varstring_fixed round-trip", "[string]")
   }
 }
 
+TEST_CASE("write_varstring_interned / read_varstring_interned round-trip", "[string][interned]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  serialstorm::string_dictionary_writer writer_dictionary;
+  std::vector<std::string> const input = {"entity", "position", "entity", "entity", "velocity", "position"};
+  for(auto const &string : input) {
+    s.write_varstring_interned(string, writer_dictionary);
+  }
+  CHECK(writer_dictionary.size() == 3);
+  // new strings cost an id byte plus a varstring, repeats cost one id byte
+  CHECK(ss.str().size() == (1 + 1 + 6) + (1 + 1 + 8) + 1 + 1 + (1 + 1 + 8) + 1);
+
+  reset_for_read(ss);
+  serialstorm::string_dictionary_reader reader_dictionary;
+  std::vector<std::string_view> output;
+  for(size_t i = 0; i != input.size(); ++i) {
+    output.emplace_back(s.read_varstring_interned(reader_dictionary));
+  }
+  for(size_t i = 0; i != input.size(); ++i) {
+    CHECK(output[i] == input[i]);
+  }
+  CHECK(output[0].data() == output[2].data());                                  // repeats refer to the same interned copy
+  CHECK(output[1].data() == output[5].data());
+  CHECK(reader_dictionary.size() == 3);
+}
+
+TEST_CASE("read_varstring_interned rejects malformed input", "[string][interned][error]") {
+  SECTION("id beyond the next in sequence") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint(1u);
+    reset_for_read(ss);
+    serialstorm::string_dictionary_reader dictionary;
+    CHECK_THROWS_AS(s.read_varstring_interned(dictionary), std::runtime_error);
+  }
+  SECTION("dictionary full") {
+    std::stringstream ss;
+    stream_t s(ss);
+    serialstorm::string_dictionary_writer writer_dictionary;
+    s.write_varstring_interned("a", writer_dictionary);
+    s.write_varstring_interned("b", writer_dictionary);
+    reset_for_read(ss);
+    serialstorm::string_dictionary_reader dictionary(1);
+    CHECK(s.read_varstring_interned(dictionary) == "a");
+    CHECK_THROWS_AS(s.read_varstring_interned(dictionary), std::runtime_error);
+  }
+  SECTION("new string longer than the limit") {
+    std::stringstream ss;
+    stream_t s(ss);
+    serialstorm::string_dictionary_writer writer_dictionary;
+    s.write_varstring_interned("too long", writer_dictionary);
+    reset_for_read(ss);
+    serialstorm::string_dictionary_reader dictionary;
+    CHECK_THROWS_AS(s.read_varstring_interned(dictionary, 4), std::runtime_error);
+  }
+}
+
 // ============================================================================
 // Blob read / write
 // ============================================================================
@@ -476,16 +754,1374 @@ TEST_CASE("write_varblob (stream) / read_varblob round-trip", "[blob]") {
   }
 }
 
+// ============================================================================
+// Standard containers and vocabulary types
+// ============================================================================
+
+TEST_CASE("write_vector / read_vector round-trip", "[container]") {
+  SECTION("trivially copyable elements are sent as one block after a varint length") {
+    std::vector<uint16_t> const input = {1, 2, 3, 0xFFFF};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_vector(input);
+    CHECK(ss.str().size() == 1 + input.size() * sizeof(uint16_t));
+    reset_for_read(ss);
+    CHECK(s.read_vector<uint16_t>() == input);
+  }
+  SECTION("empty vector") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_vector(std::vector<double>{});
+    CHECK(ss.str().size() == 1);
+    reset_for_read(ss);
+    CHECK(s.read_vector<double>().empty());
+  }
+  SECTION("vector of strings") {
+    std::vector<std::string> const input = {"alpha", "", "gamma"};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_vector(input);
+    reset_for_read(ss);
+    CHECK(s.read_vector<std::string>() == input);
+  }
+  SECTION("vector of bool") {
+    std::vector<bool> const input = {true, false, true};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_vector(input);
+    reset_for_read(ss);
+    CHECK(s.read_vector<bool>() == input);
+  }
+  SECTION("nested vectors") {
+    std::vector<std::vector<uint32_t>> const input = {{1, 2}, {}, {3}};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_value(input);
+    reset_for_read(ss);
+    CHECK(s.read_value<std::vector<std::vector<uint32_t>>>() == input);
+  }
+  SECTION("length limit exceeded throws") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_vector(std::vector<uint8_t>(20, 1));
+    reset_for_read(ss);
+    CHECK_THROWS_AS(s.read_vector<uint8_t>(10), std::runtime_error);
+  }
+}
+
+TEST_CASE("write_array / read_array round-trip without a length prefix", "[container]") {
+  std::array<int32_t, 3> const input = {-1, 0, 1};
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_array(input);
+  CHECK(ss.str().size() == sizeof(input));
+  std::array<std::string, 2> const strings = {"a", "bc"};
+  s.write_array(strings);
+  reset_for_read(ss);
+  CHECK((s.read_array<int32_t, 3>()) == input);
+  CHECK((s.read_array<std::string, 2>()) == strings);
+}
+
+TEST_CASE("write_map / read_map round-trip", "[container]") {
+  SECTION("std::map") {
+    std::map<std::string, uint32_t> const input = {{"one", 1}, {"two", 2}, {"three", 3}};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_map(input);
+    reset_for_read(ss);
+    CHECK(s.read_map<std::map<std::string, uint32_t>>() == input);
+  }
+  SECTION("std::unordered_map") {
+    std::unordered_map<uint32_t, std::vector<float>> const input = {{1, {1.0f}}, {2, {}}, {3, {2.0f, 3.0f}}};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_value(input);
+    reset_for_read(ss);
+    CHECK(s.read_value<std::unordered_map<uint32_t, std::vector<float>>>() == input);
+  }
+  SECTION("length limit exceeded throws") {
+    std::map<uint8_t, uint8_t> const input = {{1, 1}, {2, 2}, {3, 3}};
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_map(input);
+    reset_for_read(ss);
+    CHECK_THROWS_AS((s.read_map<std::map<uint8_t, uint8_t>>(2)), std::runtime_error);
+  }
+}
+
+TEST_CASE("write_optional / read_optional round-trip", "[container]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_optional(std::optional<uint32_t>{42});
+  s.write_optional(std::optional<uint32_t>{});
+  s.write_optional(std::optional<std::string>{"present"});
+  CHECK(ss.str().size() == 5 + 1 + 9);
+  reset_for_read(ss);
+  CHECK(s.read_optional<uint32_t>() == std::optional<uint32_t>{42});
+  CHECK_FALSE(s.read_optional<uint32_t>().has_value());
+  CHECK(s.read_optional<std::string>() == std::optional<std::string>{"present"});
+}
+
+TEST_CASE("write_variant / read_variant round-trip", "[container]") {
+  using variant_t = std::variant<uint8_t, std::string, std::vector<uint16_t>>;
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_variant(variant_t{uint8_t{7}});
+  s.write_variant(variant_t{std::string("text")});
+  s.write_variant(variant_t{std::vector<uint16_t>{1, 2}});
+  reset_for_read(ss);
+  CHECK(s.read_variant<variant_t>() == variant_t{uint8_t{7}});
+  CHECK(s.read_variant<variant_t>() == variant_t{std::string("text")});
+  CHECK(s.read_variant<variant_t>() == variant_t{std::vector<uint16_t>{1, 2}});
+
+  SECTION("unknown index throws") {
+    std::stringstream ss_bad;
+    stream_t s_bad(ss_bad);
+    s_bad.write_varint(3u);
+    reset_for_read(ss_bad);
+    CHECK_THROWS_AS(s_bad.read_variant<variant_t>(), std::runtime_error);
+  }
+}
+
+TEST_CASE("write_tuple / read_tuple round-trip", "[container]") {
+  using tuple_t = std::tuple<uint8_t, std::string, std::optional<double>>;
+  tuple_t const input{1, "two", 3.0};
+  std::pair<std::string, int64_t> const pair{"pair", -5};
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_tuple(input);
+  s.write_value(pair);
+  reset_for_read(ss);
+  CHECK(s.read_tuple<tuple_t>() == input);
+  CHECK((s.read_value<std::pair<std::string, int64_t>>()) == pair);
+}
+
+TEST_CASE("strings, blobs and containers can be read into a pmr arena", "[pmr]") {
+  class counting_resource : public std::pmr::memory_resource {
+    /// Upstream resource that counts the allocations made from it
+  public:
+    size_t allocations{0};
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+      ++allocations;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override {
+      return this == &other;
+    }
+  };
+
+  std::stringstream ss;
+  stream_t s(ss);
+  std::string const long_string(100, 'x');                                      // too long for the small string optimisation
+  std::vector<std::string> const strings{long_string, long_string + "y"};
+  std::map<std::string, std::vector<uint32_t>> const map{{long_string, {1, 2, 3}}};
+  s.write_varstring(long_string);
+  s.write_varstring_fixed<uint16_t>(long_string);
+  s.write_vector(strings);
+  s.write_map(map);
+  s.write_buffer(long_string.data(), long_string.size());
+
+  reset_for_read(ss);
+  counting_resource upstream;
+  std::pmr::monotonic_buffer_resource arena(&upstream);
+  std::pmr::set_default_resource(std::pmr::null_memory_resource());             // any allocation outside the arena now throws
+
+  auto const string(s.read_varstring<std::pmr::string>(0, &arena));
+  CHECK(string == long_string.c_str());
+  auto const fixed(s.read_varstring_fixed<uint16_t, std::pmr::string>(0, &arena));
+  CHECK(fixed == long_string.c_str());
+  auto const strings_read(s.read_vector<std::pmr::string, std::pmr::polymorphic_allocator<std::pmr::string>>(0, &arena));
+  REQUIRE(strings_read.size() == 2);
+  CHECK(strings_read[1] == (long_string + "y").c_str());
+  CHECK(strings_read[1].get_allocator().resource() == &arena);
+  auto const map_read(s.read_value<std::pmr::map<std::pmr::string, std::pmr::vector<uint32_t>>>(0, std::pmr::polymorphic_allocator<char>(&arena)));
+  REQUIRE(map_read.size() == 1);
+  CHECK(std::vector<uint32_t>(map_read.begin()->second.begin(), map_read.begin()->second.end()) == std::vector<uint32_t>{1, 2, 3});
+  CHECK(map_read.begin()->second.get_allocator().resource() == &arena);
+  auto const blob(s.read_blob<char>(long_string.size(), std::pmr::polymorphic_allocator<char>(&arena)));
+  CHECK(std::string(blob.begin(), blob.end()) == long_string);
+
+  std::pmr::set_default_resource(nullptr);
+  CHECK(upstream.allocations != 0);
+}
+
+TEST_CASE("pmr strings and containers of them round-trip through write_value", "[pmr]") {
+  std::pmr::monotonic_buffer_resource arena;
+  std::pmr::string const string(100, 'x', &arena);                              // too long for the small string optimisation
+  std::pmr::vector<std::pmr::string> const strings({string, std::pmr::string("y", &arena)}, &arena);
+  std::pmr::map<std::pmr::string, uint32_t> const map({{string, 1u}}, &arena);
+
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_value(string);
+  s.write_value(strings);
+  s.write_value(map);
+  s.write_varstring(string);
+
+  reset_for_read(ss);
+  CHECK(s.read_value<std::pmr::string>(0, &arena) == string);
+  CHECK(s.read_value<std::pmr::vector<std::pmr::string>>(0, std::pmr::polymorphic_allocator<char>(&arena)) == strings);
+  CHECK(s.read_value<std::pmr::map<std::pmr::string, uint32_t>>(0, std::pmr::polymorphic_allocator<char>(&arena)) == map);
+  CHECK(s.read_varstring() == std::string(100, 'x'));                           // the same wire format as a std::string
+}
+
+TEST_CASE("default_init_allocator round-trips vectors and blobs", "[pmr]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  std::vector<uint32_t> const values{1, 2, 3, 0xFFFFFFFF};
+  s.write_vector(values);
+  s.write_blob(std::vector<char>{'a', 'b', 'c'});
+
+  reset_for_read(ss);
+  auto const values_read(s.read_vector<uint32_t, serialstorm::default_init_allocator<uint32_t>>());
+  CHECK(std::vector<uint32_t>(values_read.begin(), values_read.end()) == values);
+  auto const blob(s.read_blob<char, size_t, serialstorm::default_init_allocator<char>>(3));
+  CHECK(std::string(blob.begin(), blob.end()) == "abc");
+}
+
+TEST_CASE("make_string_for_overwrite fills, clears on failure and passes errors on", "[pmr]") {
+  auto const filled(serialstorm::make_string_for_overwrite<std::string>(5, {}, [](char *data, size_t const size){
+    std::fill(data, data + size, 'z');
+  }));
+  CHECK(filled == "zzzzz");
+  auto const large(serialstorm::make_string_for_overwrite<std::string>(100000, {}, [](char *data, size_t const size){
+    std::fill(data, data + size, 'y');                                          // larger than the small string buffer, so it is allocated
+  }));
+  CHECK(large == std::string(100000, 'y'));
+  CHECK(serialstorm::make_string_for_overwrite<std::string>(5, {}, [](char*, size_t){ return false; }).empty());
+  CHECK_THROWS_AS(serialstorm::make_string_for_overwrite<std::string>(5, {}, [](char*, size_t){
+    throw std::runtime_error("fill failed");
+  }), std::runtime_error);
+}
+
+// ============================================================================
+// Non-throwing reads
+// ============================================================================
+
+TEST_CASE("try_read functions return values on well-formed input", "[try]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<uint32_t>(0xDEADBEEFu);
+  s.write_varint<uint64_t>(5u);
+  s.write_varint<uint64_t>(300u);
+  s.write_varint<uint64_t>(0x100000000ULL);
+  s.write_varstring("hello");
+  s.write_varstring_fixed<uint16_t>("fixed");
+  s.write_varblob(std::vector<char>{'a', 'b', 'c'});
+  reset_for_read(ss);
+
+  auto const pod = s.try_read_pod<uint32_t>();
+  REQUIRE(pod.has_value());
+  CHECK(*pod == 0xDEADBEEFu);
+  CHECK(s.try_read_varint<uint64_t>().value() == 5u);
+  CHECK(s.try_read_varint<uint64_t>().value() == 300u);
+  CHECK(s.try_read_varint<uint64_t>().value() == 0x100000000ULL);
+  auto const str = s.try_read_varstring(10);
+  REQUIRE(str);
+  CHECK(*str == "hello");
+  CHECK(s.try_read_varstring_fixed<uint16_t>().value() == "fixed");
+  std::ostringstream out;
+  CHECK(s.try_read_varblob(out) == serialstorm::errc::NONE);
+  CHECK(out.str() == "abc");
+  CHECK(s.tellp() == ss.str().size());
+}
+
+TEST_CASE("try_read functions report errors without throwing", "[try][error]") {
+  SECTION("unknown varint size byte") {
+    std::stringstream ss;
+    stream_t s(ss);
+    ss.put(static_cast<char>(0x90));
+    reset_for_read(ss);
+    auto const value = s.try_read_varint<size_t>();
+    CHECK_FALSE(value.has_value());
+    CHECK(value.error() == serialstorm::errc::BAD_VARINT_SIZE);
+  }
+  SECTION("varstring longer than the limit") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varstring("hello world");
+    reset_for_read(ss);
+    CHECK(s.try_read_varstring(5).error() == serialstorm::errc::LENGTH_EXCEEDED);
+  }
+  SECTION("fixed varstring longer than the limit") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varstring_fixed<uint8_t>("hello world");
+    reset_for_read(ss);
+    CHECK(s.try_read_varstring_fixed<uint8_t>(5).error() == serialstorm::errc::LENGTH_EXCEEDED);
+  }
+  SECTION("varblob longer than the limit") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varblob(std::vector<char>(100, 'x'));
+    reset_for_read(ss);
+    std::ostringstream out;
+    CHECK(s.try_read_varblob(out, 50) == serialstorm::errc::LENGTH_EXCEEDED);
+    CHECK(out.str().empty());
+  }
+  SECTION("short read of a pod") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_pod<uint16_t>(1);
+    reset_for_read(ss);
+    CHECK(s.try_read_pod<uint64_t>().error() == serialstorm::errc::SHORT_READ);
+    CHECK(s.tellp() == 0);
+  }
+  SECTION("short read of a varint body") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(70000u);
+    std::string truncated(ss.str().substr(0, 3));
+    std::stringstream ss_truncated(truncated);
+    stream_t s_truncated(ss_truncated);
+    CHECK(s_truncated.try_read_varint<uint64_t>().error() == serialstorm::errc::SHORT_READ);
+  }
+  SECTION("short read of a varstring") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(10u);
+    s.write_string(std::string("abc"));
+    reset_for_read(ss);
+    CHECK(s.try_read_varstring().error() == serialstorm::errc::SHORT_READ);
+  }
+}
+
+TEST_CASE("errc converts to std::error_code", "[try][error]") {
+  std::error_code const code(serialstorm::errc::SHORT_READ);
+  CHECK(code.category().name() == std::string("serialstorm"));
+  CHECK(code.message() == "short read on stream");
+  CHECK(static_cast<bool>(code));
+  CHECK_FALSE(static_cast<bool>(std::error_code(serialstorm::errc::NONE)));
+}
+
+// ============================================================================
+// Decode budget and allocation limit
+// ============================================================================
+
+TEST_CASE("a read budget stops decoding at the limit, and a hostile length before allocating", "[budget]") {
+  SECTION("reads within the budget succeed and use it up") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varstring("hello");
+    s.write_pod<uint32_t>(7);
+    reset_for_read(ss);
+    s.set_read_budget(6);
+    CHECK(s.read_varstring() == "hello");
+    CHECK(s.read_budget_remaining() == 0);
+    CHECK_THROWS_AS(s.read_pod<uint32_t>(), std::runtime_error);
+    s.clear_read_budget();
+    CHECK(s.read_pod<uint32_t>() == 7u);
+  }
+  SECTION("a declared length past the budget is rejected without reading it") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(std::numeric_limits<uint64_t>::max() / 2);         // far more memory than the machine has
+    s.write_string(std::string("abc"));
+    reset_for_read(ss);
+    s.set_read_budget(ss.str().size());
+    CHECK_THROWS_AS(s.read_varstring(), std::runtime_error);
+  }
+  SECTION("containers are checked against the minimum size of their elements") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(3u);
+    s.write_pod<uint32_t>(1);
+    s.write_pod<uint32_t>(2);
+    reset_for_read(ss);
+    s.set_read_budget(ss.str().size());                                         // the third element declared is missing
+    CHECK_THROWS_AS(s.read_value<std::vector<uint32_t>>(), std::runtime_error);
+    CHECK(s.tellp() == 1);
+  }
+  SECTION("non-throwing reads report the budget as exceeded") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varstring("hello world");
+    s.write_varblob(std::vector<char>(100, 'x'));
+    reset_for_read(ss);
+    s.set_read_budget(5);
+    CHECK(s.try_read_varstring().error() == serialstorm::errc::BUDGET_EXCEEDED);
+    CHECK(s.tellp() == 1);
+    s.set_read_budget(1000);
+    CHECK(s.try_read_string(11u).value() == "hello world");
+    s.set_read_budget(50);
+    std::ostringstream out;
+    CHECK(s.try_read_varblob(out) == serialstorm::errc::BUDGET_EXCEEDED);
+    CHECK(out.str().empty());
+  }
+  SECTION("the budget applies to every varint codec") {
+    for(auto const codec : {serialstorm::varint_codec::TAGGED, serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX}) {
+      std::stringstream ss;
+      stream_t s(ss);
+      s.set_varint_codec(codec);
+      s.write_varint<uint64_t>(1u << 20);
+      reset_for_read(ss);
+      s.set_read_budget(2);
+      CHECK_THROWS_AS(s.read_varint<uint64_t>(), std::runtime_error);
+      CHECK(s.tellp() <= 2);
+    }
+  }
+}
+
+TEST_CASE("an allocation limit caps each string, container and chunked block decoded", "[budget]") {
+  SECTION("strings") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_allocation_max(16);
+    CHECK(s.get_allocation_max() == 16);
+    s.write_varstring(std::string(16, 'a'));
+    s.write_varstring(std::string(17, 'b'));
+    reset_for_read(ss);
+    CHECK(s.read_varstring().size() == 16);
+    CHECK(s.try_read_varstring().error() == serialstorm::errc::BUDGET_EXCEEDED);
+    reset_for_read(ss);
+    s.read_varstring();
+    CHECK_THROWS_AS(s.read_varstring(), std::runtime_error);
+  }
+  SECTION("containers count the size of their elements in memory") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_allocation_max(16);
+    s.write_value(std::vector<uint32_t>(4, 1));
+    s.write_value(std::vector<uint32_t>(5, 1));
+    reset_for_read(ss);
+    CHECK(s.read_value<std::vector<uint32_t>>().size() == 4);
+    CHECK_THROWS_AS(s.read_value<std::vector<uint32_t>>(), std::runtime_error);
+  }
+  SECTION("elements with an empty encoding are still limited") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(std::numeric_limits<uint32_t>::max());
+    reset_for_read(ss);
+    s.set_read_budget(ss.str().size());
+    s.set_allocation_max(1024);
+    CHECK_THROWS_AS(s.read_value<std::vector<std::tuple<>>>(), std::runtime_error);
+  }
+  SECTION("chunked blocks") {
+    std::vector<char> buffer;
+    serialstorm::chunk_writer writer(buffer);
+    serialstorm::write_chunks_parallel(writer, 2, [](size_t, serialstorm::chunk_writer &chunk){
+      chunk.write_varstring(std::string(32, 'c'));
+    }, 1);
+    std::string_view view(buffer.data(), buffer.size());
+    serialstorm::chunk_reader reader(view);
+    reader.set_allocation_max(48);
+    CHECK_THROWS_AS(serialstorm::read_chunks_parallel(reader, [](size_t, serialstorm::chunk_reader&){}, 0, 0, 1), std::runtime_error);
+  }
+}
+
+// ============================================================================
+// Bit-packed fields
+// ============================================================================
+
+TEST_CASE("bit_writer / bit_reader round-trip fields of mixed widths", "[bits]") {
+  std::stringstream ss;
+  stream_t s(ss);
+
+  serialstorm::bit_writer writer(s);
+  for(unsigned int width = 1; width <= 64; ++width) {                           // widths sum to 2080 bits, so fields straddle every word boundary position
+    writer.write_bits(0xA5A5A5A5A5A5A5A5ull, width);
+  }
+  writer.write_bool(true);
+  writer.write_bool(false);
+  writer.write_bits(0xFFull, 3);                                                // high bits outside the field width are ignored
+  writer.align();
+  CHECK(s.tellw() == (2080 + 5 + 7) / 8);
+
+  reset_for_read(ss);
+  serialstorm::bit_reader reader(s);
+  for(unsigned int width = 1; width <= 64; ++width) {
+    uint64_t const expected(width == 64 ? 0xA5A5A5A5A5A5A5A5ull : 0xA5A5A5A5A5A5A5A5ull & ((uint64_t{1} << width) - 1));
+    CHECK(reader.read_bits(width) == expected);
+  }
+  CHECK(reader.read_bool() == true);
+  CHECK(reader.read_bool() == false);
+  CHECK(reader.read_bits(3) == 7u);
+  reader.align();
+  CHECK(s.tellp() == s.tellw());
+}
+
+TEST_CASE("bit-packed flags resync to byte alignment for ordinary calls", "[bits]") {
+  std::stringstream ss;
+  stream_t s(ss);
+
+  s.write_pod<uint16_t>(0x1234);
+  serialstorm::bit_writer writer(s);
+  for(unsigned int i = 0; i != 10; ++i) {
+    writer.write_bool(i % 3 == 0);
+  }
+  writer.align();
+  s.write_varint<uint32_t>(300);
+  writer.write_bits(5, 3);
+  writer.align();
+  s.write_varstring("after");
+  CHECK(s.tellw() == 2 + 2 + 3 + 1 + 6);                                        // ten flags cost two bytes, not ten
+
+  reset_for_read(ss);
+  CHECK(s.read_pod<uint16_t>() == 0x1234);
+  serialstorm::bit_reader reader(s);
+  for(unsigned int i = 0; i != 10; ++i) {
+    CHECK(reader.read_bool() == (i % 3 == 0));
+  }
+  reader.align();
+  CHECK(s.read_varint<uint32_t>() == 300u);
+  CHECK(reader.read_bits(3) == 5u);
+  reader.align();
+  CHECK(s.read_varstring() == "after");
+}
+
+TEST_CASE("bit_writer output does not depend on host byte order", "[bits]") {
+  std::stringstream ss;
+  stream_t s(ss);
+
+  serialstorm::bit_writer writer(s);
+  writer.write_bits(0x0102030405060708ull, 64);
+  writer.write_bits(0x3, 2);
+  writer.write_bits(0x1, 1);
+  writer.align();
+  CHECK(ss.str() == std::string("\x08\x07\x06\x05\x04\x03\x02\x01\x07", 9));
+}
+
+// ============================================================================
+// Memory streams and parallel chunked serialisation
+// ============================================================================
+
+TEST_CASE("stream_memory round-trips through a vector and a read-only view", "[memory]") {
+  std::vector<char> buffer;
+  serialstorm::stream_memory<std::vector<char>> writer(buffer);
+  writer.write_pod<uint32_t>(0xDEADBEEF);
+  writer.write_varstring("hello");
+  writer.write_varint<uint64_t>(123456789);
+  CHECK(buffer.size() == writer.tellw());
+
+  std::string_view view(buffer.data(), buffer.size());
+  serialstorm::stream_memory<std::string_view> reader(view);
+  CHECK(reader.read_pod<uint32_t>() == 0xDEADBEEF);
+  CHECK(reader.read_varstring() == "hello");
+  CHECK(reader.read_varint<uint64_t>() == 123456789u);
+  CHECK(reader.remaining() == 0);
+  CHECK_THROWS_AS(reader.read_pod<uint8_t>(), std::runtime_error);
+  CHECK(reader.try_read_pod<uint8_t>().error() == serialstorm::errc::SHORT_READ);
+}
+
+TEST_CASE("write_chunks_parallel / read_chunks_parallel round-trip chunks in order", "[parallel]") {
+  std::vector<std::vector<uint32_t>> chunks(13);
+  for(size_t i = 0; i != chunks.size(); ++i) {
+    chunks[i].resize(i * 100);
+    std::iota(chunks[i].begin(), chunks[i].end(), static_cast<uint32_t>(i * 1000));
+  }
+
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_varstring("before");
+  serialstorm::write_chunks_parallel(s, chunks.size(), [&](size_t const chunk, serialstorm::chunk_writer &writer) {
+    writer.write_vector(chunks[chunk]);
+    writer.write_varstring("chunk " + std::to_string(chunk));
+  }, 4);
+  s.write_varstring("after");
+
+  reset_for_read(ss);
+  CHECK(s.read_varstring() == "before");
+  std::vector<std::vector<uint32_t>> chunks_read(chunks.size());
+  std::vector<std::string> names(chunks.size());
+  serialstorm::read_chunks_parallel(s, [&](size_t const chunk, serialstorm::chunk_reader &reader) {
+    chunks_read[chunk] = reader.read_vector<uint32_t>();
+    names[chunk] = reader.read_varstring();
+  }, 0, 0, 4);
+  CHECK(s.read_varstring() == "after");
+  CHECK(s.tellp() == s.tellw());
+  CHECK(chunks_read == chunks);
+  for(size_t i = 0; i != names.size(); ++i) {
+    CHECK(names[i] == "chunk " + std::to_string(i));
+  }
+}
+
+TEST_CASE("parallel chunk errors propagate to the caller", "[parallel]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  CHECK_THROWS_AS(serialstorm::write_chunks_parallel(s, 8, [](size_t const chunk, serialstorm::chunk_writer&) {
+    if(chunk == 5) {
+      throw std::logic_error("bad chunk");
+    }
+  }), std::logic_error);
+
+  serialstorm::write_chunks_parallel(s, 3, [](size_t const chunk, serialstorm::chunk_writer &writer) {
+    writer.write_pod<uint64_t>(chunk);
+  });
+  reset_for_read(ss);
+  CHECK_THROWS_AS(serialstorm::read_chunks_parallel(s, [](size_t, serialstorm::chunk_reader&) {}, 2), std::runtime_error);
+  reset_for_read(ss);
+  CHECK_THROWS_AS(serialstorm::read_chunks_parallel(s, [](size_t, serialstorm::chunk_reader&) {}, 0, 16), std::runtime_error);
+  reset_for_read(ss);
+  CHECK_THROWS_AS(serialstorm::read_chunks_parallel(s, [](size_t, serialstorm::chunk_reader &reader) {
+    reader.read_pod<uint64_t>();
+    reader.read_pod<uint64_t>();                                                // reads past the end of the chunk
+  }), std::runtime_error);
+}
+
+#ifndef _WIN32
+namespace {
+
+std::string read_fd_contents(int const fd) {
+  /// Read back everything in a file from the start, without moving its position
+  std::string contents;
+  char buffer[4096];
+  for(off_t offset = 0;;) {
+    ssize_t const count(::pread(fd, buffer, sizeof(buffer), offset));
+    if(count <= 0) {
+      return contents;
+    }
+    contents.append(buffer, static_cast<size_t>(count));
+    offset += count;
+  }
+}
+
+}
+
+TEST_CASE("read_varblob writes straight to a file descriptor", "[blob][fd]") {
+  std::vector<char> encoded;
+  serialstorm::stream_memory<std::vector<char>> writer(encoded);
+  std::string const first(3000, 'a');
+  std::string const second("tail");
+  writer.write_varblob(std::vector<char>(first.begin(), first.end()));
+  writer.write_varblob(std::vector<char>(second.begin(), second.end()));
+  std::string_view view(encoded.data(), encoded.size());
+  serialstorm::stream_memory<std::string_view> reader(view);
+  std::FILE *const file(std::tmpfile());
+  REQUIRE(file != nullptr);
+  int const fd(fileno(file));
+
+  SECTION("at explicit offsets") {
+    reader.read_varblob(fd, 0, 100);
+    reader.read_varblob(fd, 0, 0);
+    std::string const contents(read_fd_contents(fd));
+    CHECK(contents.size() == 3100);
+    CHECK(contents.substr(0, 4) == "tail");
+    CHECK(contents.substr(100) == first);
+    CHECK(reader.tellp() == encoded.size());
+  }
+  SECTION("at the file's current position") {
+    reader.read_varblob(fd);
+    reader.read_varblob(fd);
+    CHECK(read_fd_contents(fd) == first + second);
+  }
+  SECTION("with a length limit") {
+    CHECK_THROWS_AS(reader.read_varblob(fd, 100), std::runtime_error);
+  }
+  std::fclose(file);
+}
+
+TEST_CASE("fd_sink splices from a socket to a file", "[blob][fd]") {
+  int sockets[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+  std::string payload(3 * 1024 * 1024 + 17, '\0');                              // several pipe fulls, and not a whole number of them
+  for(size_t i = 0; i != payload.size(); ++i) {
+    payload[i] = static_cast<char>(i * 31);
+  }
+  std::thread sender([&]{
+    for(size_t sent = 0; sent != payload.size();) {
+      ssize_t const count(::write(sockets[0], payload.data() + sent, payload.size() - sent));
+      if(count <= 0) {
+        return;
+      }
+      sent += static_cast<size_t>(count);
+    }
+  });
+  std::FILE *const file(std::tmpfile());
+  REQUIRE(file != nullptr);
+  int const fd(fileno(file));
+
+  SECTION("at an explicit offset") {
+    serialstorm::detail::fd_sink sink(fd, 0);
+    sink.preallocate(payload.size());
+    CHECK(sink.splice_from(sockets[1], payload.size(), []{ return true; }) == payload.size());
+  }
+  SECTION("appending, which falls back to copying out of the pipe where it can't splice") {
+    REQUIRE(::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_APPEND) == 0);
+    serialstorm::detail::fd_sink sink(fd, -1);
+    CHECK(sink.splice_from(sockets[1], payload.size(), []{ return true; }) == payload.size());
+  }
+  sender.join();
+  CHECK(read_fd_contents(fd) == payload);
+  std::fclose(file);
+  ::close(sockets[0]);
+  ::close(sockets[1]);
+}
+
+TEST_CASE("fd_sink returns what it moved when the socket closes early", "[blob][fd]") {
+  int sockets[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+  std::string const payload(1000, 'x');
+  REQUIRE(::write(sockets[0], payload.data(), payload.size()) == static_cast<ssize_t>(payload.size()));
+  ::close(sockets[0]);                                                          // the peer hangs up before the whole blob is sent
+  std::FILE *const file(std::tmpfile());
+  REQUIRE(file != nullptr);
+  int const fd(fileno(file));
+  serialstorm::detail::fd_sink sink(fd, 0);
+  CHECK(sink.splice_from(sockets[1], 4096, []{ return true; }) == payload.size());
+  CHECK(sink.spliced() == payload.size());
+  CHECK(read_fd_contents(fd) == payload);
+  std::fclose(file);
+  ::close(sockets[1]);
+}
+
+TEST_CASE("stream_datagram sends each message as one datagram, in batches", "[datagram]") {
+  int sockets[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_DGRAM, 0, sockets) == 0);
+  serialstorm::datagram_socket sender_socket(sockets[0], 256, 4);
+  serialstorm::datagram_socket receiver_socket(sockets[1], 256, 8);
+  serialstorm::stream_datagram<serialstorm::datagram_socket> sender(sender_socket);
+  serialstorm::stream_datagram<serialstorm::datagram_socket> receiver(receiver_socket);
+
+  SECTION("messages round-trip and are decoded in place, one datagram each") {
+    for(uint32_t i = 0; i != 6; ++i) {                                          // the fourth fills the batch, which is sent straight away
+      sender.write_pod(i);
+      sender.write_varstring(std::string(i * 10, 'd'));
+      sender_socket.end_datagram();
+    }
+    CHECK(sender_socket.flush() == 2);
+    CHECK(receiver_socket.receive() == 6);
+    for(uint32_t i = 0; i != 6; ++i) {
+      REQUIRE(receiver_socket.next());
+      CHECK(receiver_socket.remaining() == 4 + 1 + i * 10);
+      CHECK(receiver.read_pod<uint32_t>() == i);
+      CHECK(receiver.read_varstring() == std::string(i * 10, 'd'));
+      CHECK(receiver_socket.remaining() == 0);
+    }
+    CHECK_FALSE(receiver_socket.next());
+    CHECK(receiver_socket.receive(false) == 0);
+  }
+  SECTION("reads never run on into the next datagram") {
+    sender.write_pod<uint16_t>(1);
+    sender_socket.end_datagram();
+    sender.write_pod<uint16_t>(2);
+    sender_socket.end_datagram();
+    sender_socket.flush();
+    REQUIRE(receiver_socket.receive() == 2);
+    REQUIRE(receiver_socket.next());
+    CHECK(receiver.try_read_pod<uint32_t>().error() == serialstorm::errc::SHORT_READ);
+    CHECK_THROWS_AS(receiver.read_pod<uint32_t>(), std::runtime_error);
+    CHECK(receiver.read_pod<uint16_t>() == 1);
+    REQUIRE(receiver_socket.next());
+    CHECK(receiver.read_pod<uint16_t>() == 2);
+  }
+  SECTION("a message too large for the MTU is discarded without disturbing the next") {
+    sender.write_pod<uint64_t>(7);
+    CHECK_THROWS_AS(sender.write_value(std::string(300, 'x')), std::runtime_error);
+    CHECK(sender_socket.pending_size() == 0);
+    sender.write_pod<uint8_t>(9);
+    sender_socket.end_datagram();
+    sender_socket.flush();
+    REQUIRE(receiver_socket.receive() == 1);
+    REQUIRE(receiver_socket.next());
+    CHECK(receiver_socket.datagram() == std::string_view("\x09", 1));
+  }
+  ::close(sockets[0]);
+  ::close(sockets[1]);
+}
+#endif // _WIN32
+
+#ifdef __linux__
+TEST_CASE("stream_shm_ring carries messages between threads through shared memory", "[shm_ring]") {
+  serialstorm::shm_ring ring(serialstorm::shm_ring::create(1000));
+  REQUIRE(ring.capacity() == 4096);                                             // rounded up to a page, so long strings must wrap and wait for space
+  serialstorm::shm_ring reader_ring(serialstorm::shm_ring::open(::dup(ring.native_handle()))); // a second mapping, as another process would have
+
+  SECTION("every read and write type, with the producer and consumer taking turns to wait") {
+    std::thread producer([&]{
+      serialstorm::stream_shm_ring<serialstorm::shm_ring> writer(ring);
+      for(uint32_t i = 0; i != 500; ++i) {
+        writer.write_pod(i);
+        writer.write_varint(uint64_t{i} * 1000003u);
+        writer.write_varstring(std::string(i * 37 % 9000, static_cast<char>('a' + i % 26)));
+        writer.write_value(std::vector<uint16_t>(i % 5, static_cast<uint16_t>(i)));
+      }
+      writer.write_varblob(std::vector<char>(10000, 'z'));
+      ring.close();
+    });
+    serialstorm::stream_shm_ring<serialstorm::shm_ring> reader(reader_ring);
+    bool all_match{true};                                                       // checked once at the end, as thousands of CHECKs would swamp the report
+    for(uint32_t i = 0; i != 500; ++i) {
+      all_match &= reader.read_pod<uint32_t>() == i;
+      all_match &= reader.read_varint<uint64_t>() == uint64_t{i} * 1000003u;
+      all_match &= reader.read_varstring() == std::string(i * 37 % 9000, static_cast<char>('a' + i % 26));
+      all_match &= reader.read_value<std::vector<uint16_t>>() == std::vector<uint16_t>(i % 5, static_cast<uint16_t>(i));
+    }
+    CHECK(all_match);
+    std::FILE *const file(std::tmpfile());
+    REQUIRE(file != nullptr);
+    reader.read_varblob(fileno(file));
+    CHECK(read_fd_contents(fileno(file)) == std::string(10000, 'z'));
+    std::fclose(file);
+    producer.join();
+    CHECK(reader.try_read_pod<uint8_t>().error() == serialstorm::errc::SHORT_READ); // closed and drained
+  }
+  SECTION("messages can be decoded in place in the mapping") {
+    serialstorm::stream_shm_ring<serialstorm::shm_ring> writer(ring);
+    serialstorm::stream_shm_ring<serialstorm::shm_ring> reader(reader_ring);
+    writer.write_pod<uint32_t>(0);
+    reader.skip(4);
+    writer.write_varstring(std::string(4090, 'q'));                             // straddles the end of the data area
+    std::string_view view(reader.peek(3 + 4090));                               // a 16-bit varint length and the string
+    CHECK(view.size() == 3 + 4090);
+    serialstorm::stream_memory<std::string_view> message(view);
+    CHECK(message.read_varstring() == std::string(4090, 'q'));
+    reader.skip(message.tellp());
+    CHECK(reader.tellp() == 4 + 3 + 4090);
+    ring.close();
+    CHECK(reader.peek(1).empty());
+    CHECK_THROWS_AS(writer.write_value(std::string(5000, 'x')), std::runtime_error); // nobody is reading any more
+  }
+}
+#endif // __linux__
+
+TEST_CASE("write_gather writes buffers contiguously and counts them in tellw", "[gather]") {
+  std::vector<std::string_view> const buffers{"abc", "", "defg", "h"};
+
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_gather(buffers);
+  CHECK(ss.str() == "abcdefgh");
+  CHECK(s.tellw() == 8);
+
+  std::vector<char> memory;
+  serialstorm::stream_memory<std::vector<char>> m(memory);
+  m.write_gather(buffers);
+  CHECK(std::string(memory.begin(), memory.end()) == "abcdefgh");
+  CHECK(m.tellw() == 8);
+}
+
+TEST_CASE("writer_queue delivers whole messages from many producers in per-producer order", "[writer_queue]") {
+  constexpr uint32_t producer_count{4};
+  constexpr uint32_t message_count{2000};
+  serialstorm::writer_queue queue;
+  std::vector<char> memory;
+  serialstorm::stream_memory<std::vector<char>> m(memory);
+
+  std::vector<std::thread> producers;
+  for(uint32_t producer = 0; producer != producer_count; ++producer) {
+    producers.emplace_back([&queue, producer]{
+      for(uint32_t i = 0; i != message_count; ++i) {
+        queue.send([&](auto &writer) {
+          writer.write_varint(producer);
+          writer.write_varint(i);
+          writer.write_varstring(std::string(i % 50, static_cast<char>('a' + producer)));
+        });
+      }
+    });
+  }
+  size_t sent{0};
+  while(sent != producer_count * message_count) {                               // drain concurrently with the producers, as a sender thread would
+    sent += queue.drain(m, 16);
+  }
+  for(auto &producer : producers) {
+    producer.join();
+  }
+  CHECK(queue.empty());
+
+  std::string_view view(memory.data(), memory.size());
+  serialstorm::stream_memory<std::string_view> reader(view);
+  std::vector<uint32_t> next(producer_count, 0);
+  for(size_t i = 0; i != sent; ++i) {
+    uint32_t const producer(reader.read_varint<uint32_t>());
+    REQUIRE(producer < producer_count);
+    uint32_t const sequence(reader.read_varint<uint32_t>());
+    CHECK(sequence == next[producer]++);
+    CHECK(reader.read_varstring() == std::string(sequence % 50, static_cast<char>('a' + producer)));
+  }
+  CHECK(reader.remaining() == 0);
+}
+
+TEST_CASE("writer_queue keeps messages after a failed batch for the next drain", "[writer_queue]") {
+  struct limited_buffer {
+    /// Memory which refuses to grow past a limit, to make a write fail
+    std::vector<char> bytes;
+    size_t limit;
+    char *data() {
+      return bytes.data();
+    }
+    size_t size() const {
+      return bytes.size();
+    }
+    void resize(size_t const size) {
+      if(size > limit) {
+        throw std::length_error("full");
+      }
+      bytes.resize(size);
+    }
+  };
+  serialstorm::writer_queue queue;
+  limited_buffer memory{{}, 12};                                                // room for three four byte messages
+  serialstorm::stream_memory<limited_buffer> m(memory);
+  for(uint32_t i = 0; i != 5; ++i) {
+    queue.send([i](auto &writer) {
+      writer.template write_pod<uint32_t>(i);
+    });
+  }
+  CHECK_THROWS_AS(queue.drain(m, 2), std::length_error);                        // the second batch of messages 2 and 3 doesn't fit
+  CHECK(queue.dropped() == 2);
+  CHECK_FALSE(queue.empty());
+
+  memory.limit = 1024;
+  queue.send([](auto &writer) {
+    writer.template write_pod<uint32_t>(5);
+  });
+  CHECK(queue.drain(m, 2) == 2);
+  CHECK(queue.empty());
+  std::string_view view(memory.bytes.data(), memory.bytes.size());
+  serialstorm::stream_memory<std::string_view> reader(view);
+  for(uint32_t const expected : {0u, 1u, 4u, 5u}) {                             // message 4 was kept and sent before the newer message 5
+    CHECK(reader.read_pod<uint32_t>() == expected);
+  }
+  CHECK(reader.remaining() == 0);
+}
+
+TEST_CASE("writer_queue wakes a waiting sender", "[writer_queue]") {
+  using namespace std::chrono_literals;
+  serialstorm::writer_queue queue;
+  CHECK_FALSE(queue.wait_for(1ms));
+
+  std::vector<char> memory;
+  serialstorm::stream_memory<std::vector<char>> m(memory);
+  size_t sent{0};
+  std::thread sender([&]{
+    while(sent != 100) {
+      queue.wait();
+      sent += queue.drain(m);
+    }
+  });
+  for(uint32_t i = 0; i != 100; ++i) {
+    queue.send([i](auto &writer) {
+      writer.write_varint(i);
+    });
+    if(i % 10 == 0) {
+      std::this_thread::sleep_for(1ms);                                         // give the sender time to fall asleep
+    }
+  }
+  sender.join();
+  CHECK(sent == 100);
+
+  std::thread notified([&]{
+    queue.wait();                                                               // returns with nothing queued once notified
+  });
+  std::this_thread::sleep_for(10ms);
+  queue.notify();
+  notified.join();
+  CHECK(queue.empty());
+}
+
+TEST_CASE("shared_message is encoded once and sent to many streams behind per-stream prefixes", "[shared_message]") {
+  std::string const payload(1000, 'p');
+  serialstorm::shared_message const message(serialstorm::shared_message::encode([&](auto &writer){
+    writer.write_varstring(payload);
+    writer.template write_pod<uint32_t>(42);
+  }));
+  CHECK(message.size() == 1 + 2 + 1000 + 4);
+  CHECK(message.use_count() == 1);
+
+  std::vector<std::stringstream> subscribers(3);
+  std::vector<serialstorm::shared_message> queued;                              // one reference per subscriber, as a send queue would hold
+  for(size_t i = 0; i != subscribers.size(); ++i) {
+    queued.push_back(message);
+    std::string prefix;
+    serialstorm::stream_memory<std::string> prefix_writer(prefix);
+    prefix_writer.write_varint(i * 1000);
+    stream_t s(subscribers[i]);
+    s.write_gather(std::vector<std::string_view>{prefix, queued.back().view()});
+    CHECK(s.tellw() == prefix.size() + message.size());
+  }
+  CHECK(message.use_count() == 4);
+  CHECK(queued.front().view().data() == message.view().data());                 // shared, not copied
+  queued.clear();
+  CHECK(message.use_count() == 1);
+
+  for(size_t i = 0; i != subscribers.size(); ++i) {
+    stream_t s(subscribers[i]);
+    CHECK(s.read_varint<size_t>() == i * 1000);
+    CHECK(s.read_varstring() == payload);
+    CHECK(s.read_pod<uint32_t>() == 42);
+  }
+  CHECK(serialstorm::shared_message().empty());
+
+  serialstorm::shared_message inner;
+  serialstorm::shared_message const outer(serialstorm::shared_message::encode([&](auto &writer){
+    writer.write_varstring("outer");
+    inner = serialstorm::shared_message::encode([](auto &inner_writer){         // encoding another message part way through leaves this one intact
+      inner_writer.write_varstring("inner");
+    });
+    writer.write_varstring("tail");
+  }));
+  CHECK(outer.view() == std::string_view("\x05outer\x04tail", 11));
+  CHECK(inner.view() == std::string_view("\x05inner", 6));
+}
+
+namespace {
+
+enum class message_kind : uint16_t {
+  HELLO = 0x1234
+};
+
+template<typename WriterT>
+constexpr void write_handshake(WriterT &writer) {
+  /// A fixed message written identically at compile time and at run time
+  writer.write_pod(uint32_t{0x53544F52});
+  writer.write_pod(message_kind::HELLO);
+  writer.write_pod(true);
+  writer.write_pod(int8_t{-2});
+  writer.write_pod(uint64_t{0x0102030405060708});
+  uint64_t const varints[]{0, 127, 128, 255, 256, 65535, 65536, 4294967295, 4294967296, UINT64_MAX}; // both sides of every size boundary
+  for(uint64_t const value : varints) {
+    writer.write_varint(value);
+  }
+  writer.write_varstring("serialstorm");
+}
+
+template<serialstorm::varint_codec Codec>
+void check_static_message_matches_runtime(serialstorm::varint_codec const codec) {
+  constexpr auto encoded(serialstorm::encode_static<Codec>([](auto &writer){
+    write_handshake(writer);
+  }));
+  std::vector<char> expected;
+  serialstorm::stream_memory<std::vector<char>> writer(expected);
+  writer.set_varint_codec(codec);
+  write_handshake(writer);
+  REQUIRE(encoded.size() == expected.size());
+  CHECK(std::memcmp(encoded.data(), expected.data(), expected.size()) == 0);
+
+  std::vector<char> sent;                                                       // sending it is one buffer write
+  serialstorm::stream_memory<std::vector<char>> sender(sent);
+  sender.write_buffer(encoded.data(), encoded.size());
+  CHECK(sent == expected);
+}
+
+}
+
+TEST_CASE("static messages encoded at compile time match the runtime encoding", "[static_message]") {
+  static_assert(serialstorm::encode_static([](auto &writer){
+    write_handshake(writer);
+  }).size() == 16 + 40 + 12, "SerialStorm: the size of a static message is known at compile time"); // pods, tagged varints and varstring
+  check_static_message_matches_runtime<serialstorm::varint_codec::TAGGED>(serialstorm::varint_codec::TAGGED);
+  check_static_message_matches_runtime<serialstorm::varint_codec::LEB128>(serialstorm::varint_codec::LEB128);
+  check_static_message_matches_runtime<serialstorm::varint_codec::PREFIX>(serialstorm::varint_codec::PREFIX);
+}
+
+// ============================================================================
+// Tagged records
+// ============================================================================
+
+namespace {
+
+struct player_v1 {                                                              // a message as first shipped
+  uint32_t id{0};
+  std::string name;
+  float health{0};
+};
+struct player_v2 {                                                              // the same message after adding fields
+  uint32_t id{0};
+  std::string name;
+  float health{0};
+  std::vector<uint16_t> scores;
+  std::optional<std::string> guild;
+  int64_t balance{0};
+};
+
+using player_v1_record = serialstorm::record<serialstorm::field<1, &player_v1::id>,
+                                             serialstorm::field<2, &player_v1::name>,
+                                             serialstorm::field<3, &player_v1::health>>;
+using player_v2_record = serialstorm::record<serialstorm::field<1, &player_v2::id>,
+                                             serialstorm::field<2, &player_v2::name>,
+                                             serialstorm::field<3, &player_v2::health>,
+                                             serialstorm::field<4, &player_v2::scores>,
+                                             serialstorm::field<6, &player_v2::guild>,
+                                             serialstorm::field<9, &player_v2::balance>>;
+
+class unseekable_buffer : public std::streambuf {
+  /// Read-only stream buffer over a string which can't seek, like a pipe
+public:
+  explicit unseekable_buffer(std::string &data) {
+    setg(data.data(), data.data(), data.data() + data.size());
+  }
+};
+
+}
+
+TEST_CASE("tagged records round-trip with every varint codec", "[record]") {
+  for(auto const codec : {serialstorm::varint_codec::TAGGED, serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX}) {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_varint_codec(codec);
+    player_v2 const sent{12345, "Ada", 0.75f, {1, 500, 65535}, std::string("Voxel"), -9000000000};
+    player_v2 const unguilded{7, "Bob", 1.0f, {}, std::nullopt, 0};
+    player_v2_record::write(s, sent);
+    player_v2_record::write(s, unguilded);
+    reset_for_read(ss);
+    player_v2 const received(player_v2_record::read(s));
+    CHECK(received.id == sent.id);
+    CHECK(received.name == sent.name);
+    CHECK(received.health == sent.health);
+    CHECK(received.scores == sent.scores);
+    CHECK(received.guild == sent.guild);
+    CHECK(received.balance == sent.balance);
+    player_v2 const received_unguilded(player_v2_record::read(s));
+    CHECK(received_unguilded.name == "Bob");
+    CHECK_FALSE(received_unguilded.guild.has_value());
+    CHECK(s.tellp() == ss.str().size());
+  }
+}
+
+TEST_CASE("tagged records are readable by older and newer readers", "[record]") {
+  SECTION("an old reader skips fields it doesn't know") {
+    std::stringstream ss;
+    stream_t s(ss);
+    player_v2_record::write(s, player_v2{1, "Ada", 0.5f, {1, 2, 3}, std::string("Voxel"), 42});
+    s.write_pod<uint32_t>(0xDEADBEEF);
+    reset_for_read(ss);
+    player_v1 const received(player_v1_record::read(s));
+    CHECK(received.id == 1);
+    CHECK(received.name == "Ada");
+    CHECK(received.health == 0.5f);
+    CHECK(s.read_pod<uint32_t>() == 0xDEADBEEF);                                // still in step after skipping
+    CHECK(s.tellp() == ss.str().size());
+  }
+  SECTION("an old reader skips fields through a stream that can't seek") {
+    std::stringstream ss;
+    stream_t s(ss);
+    player_v2_record::write(s, player_v2{1, "Ada", 0.5f, std::vector<uint16_t>(1000, 7), std::nullopt, 42});
+    s.write_pod<uint32_t>(0xDEADBEEF);
+    std::string data(ss.str());
+    unseekable_buffer buffer(data);
+    std::istream stream(&buffer);
+    serialstorm::stream_std_stream<std::istream> reader(stream);
+    CHECK(player_v1_record::read(reader).name == "Ada");
+    CHECK(reader.read_pod<uint32_t>() == 0xDEADBEEF);
+  }
+  SECTION("a new reader leaves fields that weren't sent unchanged") {
+    std::stringstream ss;
+    stream_t s(ss);
+    player_v1_record::write(s, player_v1{2, "Bob", 1.0f});
+    reset_for_read(ss);
+    player_v2 received;
+    received.scores = {9, 9};
+    player_v2_record::read_into(s, received);
+    CHECK(received.id == 2);
+    CHECK(received.name == "Bob");
+    CHECK(received.scores == std::vector<uint16_t>{9, 9});
+    CHECK_FALSE(received.guild.has_value());
+  }
+}
+
+TEST_CASE("tagged record wire format and malformed records", "[record]") {
+  SECTION("keys hold the tag and wire type, and a zero key ends the record") {
+    std::stringstream ss;
+    stream_t s(ss);
+    player_v1_record::write(s, player_v1{5, "A", 0.0f});
+    CHECK(ss.str() == std::string("\x08\x05"                                    // tag 1, varint
+                                  "\x15\x01" "A"                                // tag 2, length-delimited
+                                  "\x1B" "\x00\x00\x00\x00"                     // tag 3, fixed32
+                                  "\x00", 11));
+  }
+  SECTION("a known tag with the wrong wire type is rejected") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>((1u << 3) | static_cast<uint64_t>(serialstorm::wire_type::FIXED64));
+    s.write_pod<uint64_t>(1);
+    s.write_varint<uint64_t>(0u);
+    reset_for_read(ss);
+    CHECK_THROWS_AS(player_v1_record::read(s), std::runtime_error);
+  }
+  SECTION("an unknown wire type can't be skipped") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>((100u << 3) | 7u);
+    reset_for_read(ss);
+    CHECK_THROWS_AS(player_v1_record::read(s), std::runtime_error);
+  }
+  SECTION("a length-delimited value must fill its declared length") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>((4u << 3) | static_cast<uint64_t>(serialstorm::wire_type::LENGTH_DELIMITED));
+    s.write_varint<uint64_t>(5u);                                               // two bytes longer than the vector that follows
+    s.write_value(std::vector<uint16_t>{1});
+    s.write_pod<uint16_t>(0);
+    s.write_varint<uint64_t>(0u);
+    reset_for_read(ss);
+    CHECK_THROWS_AS(player_v2_record::read(s), std::runtime_error);
+  }
+  SECTION("a length-delimited value can't read past its declared length into the next field") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>((4u << 3) | static_cast<uint64_t>(serialstorm::wire_type::LENGTH_DELIMITED));
+    s.write_varint<uint64_t>(3u);                                               // shorter than the vector that follows
+    size_t const value_start(s.tellw());
+    s.write_value(std::vector<uint16_t>{1, 2, 3});
+    s.write_varint<uint64_t>(0u);
+    reset_for_read(ss);
+    s.set_read_budget(ss.str().size());
+    CHECK_THROWS_AS(player_v2_record::read(s), std::runtime_error);
+    CHECK(s.tellp() <= value_start + 3);
+    CHECK(s.read_budget_remaining() == ss.str().size() - s.tellp());            // the enclosing budget is restored
+  }
+  SECTION("the enclosing budget still applies around length-delimited values") {
+    std::stringstream ss;
+    stream_t s(ss);
+    player_v2 const player{7, "B", 1.0f, {1, 2, 3}, std::string("guild"), -9};
+    player_v2_record::write(s, player);
+    size_t const size(ss.str().size());
+    reset_for_read(ss);
+    s.set_read_budget(size);
+    CHECK(player_v2_record::read(s).scores == player.scores);
+    CHECK(s.read_budget_remaining() == 0);
+    reset_for_read(ss);
+    s.set_read_budget(size - 1);                                                // too short to finish the record
+    CHECK_THROWS_AS(player_v2_record::read(s), std::runtime_error);
+  }
+}
+
+// ============================================================================
+// Columnar batches
+// ============================================================================
+
+namespace {
+
+struct entity_state {
+  uint32_t id{0};
+  uint64_t tick{0};
+  int16_t health{0};
+  std::array<float, 3> position{};
+  bool visible{false};
+  std::string name;
+};
+
+using entity_batch = serialstorm::columns<serialstorm::column<&entity_state::id, serialstorm::column_encoding::DELTA>,
+                                          serialstorm::column<&entity_state::tick>,
+                                          serialstorm::column<&entity_state::health>,
+                                          serialstorm::column<&entity_state::position>,
+                                          serialstorm::column<&entity_state::visible>,
+                                          serialstorm::column<&entity_state::name>>;
+
+}
+
+TEST_CASE("columnar batches round-trip with every varint codec", "[columns]") {
+  std::vector<entity_state> sent;
+  for(uint32_t i = 0; i != 5000; ++i) {                                         // spans several blocks of the pod columns
+    sent.push_back(entity_state{1000 + i * 3, 900000000000u + i, static_cast<int16_t>(i % 2 ? -static_cast<int>(i % 300) : static_cast<int>(i % 300)), {i * 0.5f, -1.0f, 2.0f}, i % 3 == 0, i % 7 == 0 ? std::string("entity") : std::string()});
+  }
+  sent[10].id = 5;                                                              // deltas go backwards as well as forwards
+  sent[11].id = 4000000000u;
+  for(auto const codec : {serialstorm::varint_codec::TAGGED, serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX}) {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_varint_codec(codec);
+    entity_batch::write(s, sent);
+    s.write_pod<uint32_t>(0xDEADBEEF);
+    reset_for_read(ss);
+    std::vector<entity_state> received{entity_state{}};
+    entity_batch::read_into(s, received, 10000);
+    REQUIRE(received.size() == sent.size());
+    for(size_t i = 0; i != sent.size(); ++i) {
+      CHECK(received[i].id == sent[i].id);
+      CHECK(received[i].tick == sent[i].tick);
+      CHECK(received[i].health == sent[i].health);
+      CHECK(received[i].position == sent[i].position);
+      CHECK(received[i].visible == sent[i].visible);
+      CHECK(received[i].name == sent[i].name);
+    }
+    CHECK(s.read_pod<uint32_t>() == 0xDEADBEEF);
+    CHECK(s.tellp() == ss.str().size());
+  }
+  SECTION("an empty batch is just its record count") {
+    std::stringstream ss;
+    stream_t s(ss);
+    entity_batch::write(s, std::vector<entity_state>());
+    reset_for_read(ss);
+    CHECK(entity_batch::read(s).empty());
+  }
+}
+
+TEST_CASE("columnar batch wire format and malformed batches", "[columns]") {
+  using id_batch = serialstorm::columns<serialstorm::column<&entity_state::id, serialstorm::column_encoding::DELTA>,
+                                        serialstorm::column<&entity_state::health>>;
+  SECTION("integer columns are varint blocks, deltas and signed values zigzag encoded") {
+    std::stringstream ss;
+    stream_t s(ss);
+    id_batch::write(s, std::vector<entity_state>{{50, 0, -1, {}, false, {}}, {51, 0, 1, {}, false, {}}, {49, 0, -2, {}, false, {}}});
+    CHECK(ss.str() == std::string("\x03"                                        // three records
+                                  "\x03" "\x64\x02\x03"                          // ids 50, +1, -2
+                                  "\x03" "\x01\x02\x03", 9));                   // health -1, 1, -2
+  }
+  SECTION("a batch is smaller than the same records sent one by one") {
+    std::vector<entity_state> sent;
+    for(uint32_t i = 0; i != 1000; ++i) {
+      sent.push_back(entity_state{100000 + i, 0, 10, {}, false, {}});
+    }
+    std::stringstream ss_columns;
+    stream_t s_columns(ss_columns);
+    id_batch::write(s_columns, sent);
+    std::stringstream ss_rows;
+    stream_t s_rows(ss_rows);
+    for(auto const &entity : sent) {
+      s_rows.write_pod(entity.id);
+      s_rows.write_pod(entity.health);
+    }
+    CHECK(ss_columns.str().size() < ss_rows.str().size() / 2);
+  }
+  SECTION("a varint column must fill its declared length") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(2u);
+    s.write_varint<uint64_t>(3u);                                               // one byte longer than the two ids that follow
+    s.write_pod<uint8_t>(1);
+    s.write_pod<uint8_t>(1);
+    s.write_pod<uint8_t>(1);
+    s.write_varint<uint64_t>(2u);
+    s.write_pod<uint8_t>(0);
+    s.write_pod<uint8_t>(0);
+    reset_for_read(ss);
+    CHECK_THROWS_AS(id_batch::read(s), std::runtime_error);
+  }
+  SECTION("a varint column must hold as many values as there are records") {
+    for(auto const codec : {serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX, serialstorm::varint_codec::TAGGED}) {
+      std::stringstream ss;
+      ss.str(std::string("\x02\x02\x80\x05", 4));                               // two records, but the id column holds only one tagged or LEB128 varint
+      stream_t s(ss);
+      s.set_varint_codec(codec);
+      CHECK_THROWS_AS(id_batch::read(s), std::runtime_error);
+    }
+  }
+  SECTION("record counts are limited before anything is allocated") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(1000000000u);
+    reset_for_read(ss);
+    CHECK_THROWS_AS(id_batch::read(s, 1000), std::runtime_error);
+    reset_for_read(ss);
+    s.set_read_budget(64);
+    CHECK_THROWS_AS(entity_batch::read(s), std::runtime_error);
+  }
+  SECTION("batches of only varint columns are limited by the decode budget before anything is allocated") {
+    std::stringstream ss;
+    stream_t s(ss);
+    s.write_varint<uint64_t>(1000000u);
+    size_t const count_size(ss.str().size());
+    s.write_varint<uint64_t>(1000000u);                                         // a column length to match, which must never be reached
+    reset_for_read(ss);
+    s.set_read_budget(64);
+    CHECK_THROWS_AS(id_batch::read(s), std::runtime_error);
+    CHECK(s.tellp() == count_size);
+  }
+}
+
 // ============================================================================
 // Read-position tracking (tellp)
 // ============================================================================
 
 TEST_CASE("stream_base::tellp() reports the running tally of bytes consumed from the stream", "[tellp]") {
-  // tellp() is incremented exclusively by stream_base::read_buffer, which is
-  // invoked by read_pod and read_varint.  Derived-class string/blob helpers
-  // that call stream_std_stream::read_buffer directly do not go through the
-  // tracking path, so only the varint length prefix is counted for varstring.
-  // This test therefore exercises only pod and varint reads.
+  // tellp() is incremented by stream_base::read_buffer, which is invoked by
+  // read_pod and read_varint, and by stream_base::read_string.  Calls made
+  // directly on the derived stream class bypass the tracking path.
   std::stringstream ss;
   stream_t s(ss);
 
@@ -514,6 +2150,48 @@ TEST_CASE("stream_base::tellp() reports the running tally of bytes consumed from
   CHECK(s.tellp() == 10);
 }
 
+TEST_CASE("stream_base::tellp() counts varstring payloads as well as their length prefix", "[tellp]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_varstring("hello");       //  1 byte length + 5 bytes payload
+  s.write_pod<uint16_t>(7);         //  2 bytes
+  reset_for_read(ss);
+
+  CHECK(s.read_varstring() == "hello");
+  CHECK(s.tellp() == 6);
+  s.read_pod<uint16_t>();
+  CHECK(s.tellp() == 8);
+}
+
+// ============================================================================
+// Write-position tracking (tellw)
+// ============================================================================
+
+TEST_CASE("stream_base::tellw() reports the running tally of bytes written to the stream", "[tellw]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  CHECK(s.tellw() == 0);
+
+  s.write_pod<uint32_t>(3);
+  CHECK(s.tellw() == 4);
+
+  s.write_varint<uint64_t>(1000u);  //  3 bytes (tag + uint16_t value)
+  CHECK(s.tellw() == 7);
+
+  s.write_varstring("hello");       //  1 byte length + 5 bytes payload
+  CHECK(s.tellw() == 13);
+
+  std::vector<char> const blob(200, 'x');
+  s.write_varblob(blob);            //  2 byte length + 200 bytes payload
+  CHECK(s.tellw() == 215);
+
+  std::istringstream instream("stream payload");
+  s.write_varblob(instream, 14);    //  1 byte length + 14 bytes payload
+  CHECK(s.tellw() == 230);
+
+  CHECK(ss.str().size() == s.tellw());
+}
+
 // ============================================================================
 // Mixed sequential serialisation round-trip
 // ============================================================================
@@ -0,0 +1,116 @@
+/// Tests for the optional per-stream instrumentation counters.
+/// Built as a separate executable because SERIALSTORM_STATS changes the
+/// layout of stream_base.
+
+#define SERIALSTORM_STATS
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "serialstorm/stream_std_stream.h"
+
+using stream_t = serialstorm::stream_std_stream<std::stringstream>;
+
+TEST_CASE("stats count pod, varint, string and blob operations on write", "[stats]") {
+  std::stringstream ss;
+  stream_t s(ss);
+
+  s.write_pod<uint32_t>(1);
+  s.write_pod<uint8_t>(2);
+  s.write_varint<uint64_t>(5u);                                                 // 1 byte
+  s.write_varint<uint64_t>(200u);                                               // 2 bytes
+  s.write_varint<uint64_t>(70000u);                                             // 5 bytes
+  s.write_varstring("hello");                                                   // 1 byte varint + 5 byte string
+  s.write_varblob(std::vector<char>(10, 'x'));                                  // 1 byte varint + 10 byte blob
+
+  auto const &w = s.stats().write;
+  CHECK(w.pod.calls == 2);
+  CHECK(w.pod.bytes == 5);
+  CHECK(w.varint.calls == 5);
+  CHECK(w.varint.bytes == 1 + 2 + 5 + 1 + 1);
+  CHECK(w.varint_sizes[1] == 3);
+  CHECK(w.varint_sizes[2] == 1);
+  CHECK(w.varint_sizes[5] == 1);
+  CHECK(w.string.calls == 1);
+  CHECK(w.string.bytes == 5);
+  CHECK(w.blob.calls == 1);
+  CHECK(w.blob.bytes == 10);
+  CHECK(w.backend.bytes == ss.str().size());
+  CHECK(w.backend.bytes == s.tellw());
+  CHECK(w.backend.calls == 2 + 1 + 2 + 2 + 2 + 2);                              // one call per pod, two for each tagged varint
+}
+
+TEST_CASE("stats count pod, varint, string and blob operations on read", "[stats]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<uint16_t>(7);
+  s.write_varint<uint64_t>(300u);                                               // 3 bytes
+  s.write_varstring("abc");
+  s.write_varblob(std::vector<char>(4, 'y'));
+  ss.seekg(0);
+
+  s.read_pod<uint16_t>();
+  s.read_varint<uint64_t>();
+  s.read_varstring();
+  std::ostringstream out;
+  s.read_varblob(out);
+
+  auto const &r = s.stats().read;
+  CHECK(r.pod.calls == 1);
+  CHECK(r.pod.bytes == 2);
+  CHECK(r.varint.calls == 3);
+  CHECK(r.varint.bytes == 3 + 1 + 1);
+  CHECK(r.varint_sizes[1] == 2);
+  CHECK(r.varint_sizes[3] == 1);
+  CHECK(r.string.calls == 1);
+  CHECK(r.string.bytes == 3);
+  CHECK(r.blob.calls == 1);
+  CHECK(r.blob.bytes == 4);
+  CHECK(r.backend.bytes == ss.str().size());
+  CHECK(r.backend.bytes == s.tellp());
+}
+
+TEST_CASE("reset_stats zeroes all counters", "[stats]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.write_pod<uint32_t>(1);
+  s.write_varint<uint64_t>(1u);
+  s.reset_stats();
+  CHECK(s.stats().write.pod.calls == 0);
+  CHECK(s.stats().write.varint.calls == 0);
+  CHECK(s.stats().write.varint_sizes[1] == 0);
+  CHECK(s.stats().write.backend.bytes == 0);
+}
+
+TEST_CASE("stats bands varints by encoded size for every codec", "[stats]") {
+  std::stringstream ss;
+  stream_t s(ss);
+  s.set_varint_codec(serialstorm::varint_codec::LEB128);
+  s.write_varint<uint64_t>(200u);                                               // 2 bytes
+  s.write_varint<uint64_t>(UINT64_MAX);                                         // 10 bytes
+  s.set_varint_codec(serialstorm::varint_codec::PREFIX);
+  s.write_varint<uint64_t>(20000u);                                             // 3 bytes
+
+  auto const &w = s.stats().write;
+  CHECK(w.varint.calls == 3);
+  CHECK(w.varint.bytes == 2 + 10 + 3);
+  CHECK(w.varint_sizes[2] == 1);
+  CHECK(w.varint_sizes[10] == 1);
+  CHECK(w.varint_sizes[3] == 1);
+  CHECK(w.pod.calls == 0);
+  CHECK(w.backend.bytes == s.tellw());
+
+  s.set_varint_codec(serialstorm::varint_codec::LEB128);
+  s.read_varint<uint64_t>();
+  s.read_varint<uint64_t>();
+  s.set_varint_codec(serialstorm::varint_codec::PREFIX);
+  s.read_varint<uint64_t>();
+  auto const &r = s.stats().read;
+  CHECK(r.varint.bytes == 2 + 10 + 3);
+  CHECK(r.varint_sizes[10] == 1);
+  CHECK(r.backend.bytes == s.tellp());
+}
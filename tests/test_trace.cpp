@@ -0,0 +1,145 @@
+/// Tests for the compile-time latency tracing hooks.
+/// Built as a separate executable because SERIALSTORM_TRACE must be defined,
+/// naming the policy, before any SerialStorm stream header is included.
+
+#include "serialstorm/trace.h"
+
+#include <cstdint>
+#include <vector>
+
+struct recording_policy {
+  /// Test policy recording every operation seen, checking begin and end pair up
+  struct event {
+    serialstorm::trace_op op;
+    size_t size;
+  };
+  using token = size_t;
+
+  static inline std::vector<event> events;
+  static inline size_t open{0};
+
+  static token begin(serialstorm::trace_op op, size_t size) noexcept {
+    ++open;
+    return events.size() + size + static_cast<size_t>(op);
+  }
+  static void end(serialstorm::trace_op op, size_t size, token const &start) noexcept {
+    --open;
+    if(start == events.size() + size + static_cast<size_t>(op)) {              // only record if the token survived intact
+      events.push_back({op, size});
+    }
+  }
+};
+
+#define SERIALSTORM_TRACE recording_policy
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <sstream>
+#include <string>
+
+#include "serialstorm/stream_std_stream.h"
+
+using stream_t = serialstorm::stream_std_stream<std::stringstream>;
+using serialstorm::trace_op;
+
+TEST_CASE("tracing policy is called around every backend call", "[trace]") {
+  recording_policy::events.clear();
+  std::stringstream ss;
+  stream_t s(ss);
+
+  s.write_pod<uint32_t>(1);
+  s.write_varstring("hello");
+  s.write_varblob(std::vector<char>(3, 'x'));
+  ss.seekg(0);
+  s.read_pod<uint32_t>();
+  s.read_varstring();
+
+  auto const &events = recording_policy::events;
+  CHECK(recording_policy::open == 0);
+  REQUIRE(events.size() == 8);
+  CHECK(events[0].op == trace_op::WRITE_BUFFER);
+  CHECK(events[0].size == 4);
+  CHECK(events[1].op == trace_op::WRITE_BUFFER);                                // varint length prefix
+  CHECK(events[1].size == 1);
+  CHECK(events[2].op == trace_op::WRITE_STRING);
+  CHECK(events[2].size == 5);
+  CHECK(events[3].op == trace_op::WRITE_BUFFER);
+  CHECK(events[3].size == 1);
+  CHECK(events[4].op == trace_op::WRITE_BLOB);
+  CHECK(events[4].size == 3);
+  CHECK(events[5].op == trace_op::READ_BUFFER);
+  CHECK(events[5].size == 4);
+  CHECK(events[6].op == trace_op::READ_BUFFER);
+  CHECK(events[6].size == 1);
+  CHECK(events[7].op == trace_op::READ_STRING);
+  CHECK(events[7].size == 5);
+}
+
+TEST_CASE("tracing covers varints in the byte-oriented codecs", "[trace]") {
+  for(auto const codec : {serialstorm::varint_codec::LEB128, serialstorm::varint_codec::PREFIX}) {
+    CAPTURE(static_cast<int>(codec));
+    recording_policy::events.clear();
+    std::stringstream ss;
+    stream_t s(ss);
+    s.set_varint_codec(codec);
+
+    s.write_varint(300u);                                                       // two bytes in either codec
+    ss.seekg(0);
+    s.read_varint<uint32_t>();
+    ss.seekg(0);
+    CHECK(s.try_read_varint<uint32_t>().value() == 300u);
+
+    auto const &events = recording_policy::events;
+    CHECK(recording_policy::open == 0);
+    REQUIRE(events.size() == 5);
+    CHECK(events[0].op == trace_op::WRITE_BUFFER);                              // encoded whole, then written in one call
+    CHECK(events[0].size == 2);
+    for(size_t i = 1; i != events.size(); ++i) {                                // read a byte at a time for LEB128, or the first byte and then the rest for PREFIX
+      CHECK(events[i].op == trace_op::READ_BUFFER);
+      CHECK(events[i].size == 1);
+    }
+  }
+}
+
+TEST_CASE("trace_histogram buckets are contiguous and ordered", "[trace]") {
+  using histogram = serialstorm::trace_histogram;
+  for(uint64_t value : {uint64_t{0}, uint64_t{15}, uint64_t{16}, uint64_t{31}, uint64_t{32}, uint64_t{1000}, uint64_t{123456789}, ~uint64_t{0}}) {
+    CAPTURE(value);
+    size_t const index(histogram::bucket_index(value));
+    CHECK(index < histogram::bucket_count);
+    CHECK(histogram::bucket_upper_bound(index) >= value);
+    if(index != 0) {
+      CHECK(histogram::bucket_upper_bound(index - 1) < value);
+    }
+  }
+  CHECK(histogram::bucket_index(~uint64_t{0}) == histogram::bucket_count - 1);
+}
+
+TEST_CASE("trace_histogram reports percentiles of recorded values", "[trace]") {
+  using histogram = serialstorm::trace_histogram;
+  histogram::reset();
+  CHECK(histogram::percentile(trace_op::READ_BUFFER, 50) == 0);
+  for(uint64_t i = 1; i <= 100; ++i) {
+    histogram::record(trace_op::READ_BUFFER, i * 1000);                         // 1us to 100us
+  }
+  histogram::record(trace_op::WRITE_BUFFER, 5);
+  CHECK(histogram::count(trace_op::READ_BUFFER) == 100);
+  CHECK(histogram::count(trace_op::WRITE_BUFFER) == 1);
+
+  uint64_t const p50(histogram::percentile(trace_op::READ_BUFFER, 50));
+  CHECK(p50 >= 50000);
+  CHECK(p50 <= 54000);                                                          // within the ~6% bucket precision
+  uint64_t const p99(histogram::percentile(trace_op::READ_BUFFER, 99));
+  CHECK(p99 >= 99000);
+  CHECK(p99 <= 106000);
+  CHECK(histogram::percentile(trace_op::READ_BUFFER, 100) >= 100000);
+  CHECK(histogram::percentile(trace_op::WRITE_BUFFER, 50) == 5);
+
+  histogram::reset();
+  CHECK(histogram::count(trace_op::READ_BUFFER) == 0);
+}
+
+TEST_CASE("trace_usdt can be driven without a tracer attached", "[trace]") {
+  serialstorm::trace_scope<serialstorm::trace_usdt> const scope(trace_op::READ_BUFFER, 8);
+  SUCCEED();
+}